@@ -1,4 +1,5 @@
 #include "packetutils.h"
+#include "appfsfunctions.h"
 #include <string.h>
 #include <esp_log.h>
 #include "freertos/FreeRTOS.h"
@@ -7,23 +8,13 @@
 #include "soc/rtc_cntl_reg.h"
 #include "esp_sleep.h"
 #include "fsob_backend.h"
+#include "requests.h"
+#include "functions.h"
 #include "esp_spi_flash.h"
+#include "mbedtls/sha256.h"
 
 #define TAG "fsob_appfs"
-
-/**
- * @brief Redefine the appfs functions used. This allows to compile the component when appfs support is disabled.
- * 
- */
-#define APPFS_INVALID_FD (-1)
-typedef int appfs_handle_t;
-void appfsEntryInfo(appfs_handle_t fd, const char **name, int *size);
-appfs_handle_t appfsNextEntry(appfs_handle_t fd);
-esp_err_t appfsDeleteFile(const char *filename);
-esp_err_t appfsCreateFile(const char *filename, size_t size, appfs_handle_t *handle);
-esp_err_t appfsErase(appfs_handle_t fd, size_t start, size_t len);
-esp_err_t appfsWrite(appfs_handle_t fd, size_t start, uint8_t *buf, size_t len);
-appfs_handle_t appfsOpen(const char *filename);
+#define APPFS_MMAP_WINDOW (SPI_FLASH_MMU_PAGE_SIZE)    //Mapped at a time, large apps would otherwise run out of MMU pages
 
 int appfslist(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
     if(received != size) return 0;
@@ -44,7 +35,8 @@ int appfslist(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t siz
     
     uint8_t header[12];    
     createMessageHeader(header, command, payloadlength, message_id);
-    fsob_write_bytes((const char*) header, 12);
+    fsob_tx_lock();
+    fsob_write_header(header);
     fsob_write_bytes((char *) &amount_of_files, 4);
     
     appfs_fd = APPFS_INVALID_FD;
@@ -59,6 +51,7 @@ int appfslist(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t siz
         fsob_write_bytes((char *) &name_length, 4);
         fsob_write_bytes(name, name_length);
     }
+    fsob_tx_unlock();
     return 1;
 }
 
@@ -74,83 +67,244 @@ int appfsdel(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size
 }
 
 int appfswrite(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
-    static appfs_handle_t handle = APPFS_INVALID_FD;
-    static bool failed_open = false;
-    static int app_size = 0;
-    static int written = 0;
-    
-    if(received == length) {    //Opening new file, cleaning up statics just in case
-        failed_open = false;
-        handle = APPFS_INVALID_FD;
-        app_size = 0;
-        written = 0;
-    }
-
-    if(handle == APPFS_INVALID_FD && failed_open == false) {
-        for(int i = 0; i < received; i++) {
-            if(data[i] == 0) {
-                app_size = size-i;
-                esp_err_t res = appfsCreateFile((char *) data, app_size, &handle);
-                if (res != ESP_OK) {
-                    failed_open = true;
-                    return 1;
-                }
-
-                int roundedSize=(app_size+(SPI_FLASH_MMU_PAGE_SIZE-1))&(~(SPI_FLASH_MMU_PAGE_SIZE-1));
-                ESP_LOGI(TAG, "Erasing flash");
-                res = appfsErase(handle, 0, roundedSize);
+    fsob_request_t *req;
+    if(received == length) {    //Opening new file
+        req = fsob_request_open(command, message_id);
+        req->appfs = true;
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
 
-                if(length > i) {
-                    appfsWrite(handle, 0, &data[i+1], length-i);
-                    written = length - i;
-                }
+    if(req->write_ctx == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(i == received) return 0;   //App name not complete yet
 
-                if(received == size) {    //Creating an empty file or short. Close the file and send reply
-                    failed_open = 0;
-                    if(handle != APPFS_INVALID_FD) {
-                        sendok(command, message_id);
-                        handle = APPFS_INVALID_FD;
-                    } else {
-                        sender(command, message_id);
-                    }
-                }
-                return 1;
-            }
+        uint32_t app_size = size-i-1;
+        uint32_t data_start = i+1;
+        if(command & COMPRESSEDFLAG) {  //Compressed data is preceded by the size of the app
+            if(received < i+1+4) return 0;
+            memcpy(&app_size, &data[i+1], 4);
+            data_start += 4;
+            req->lz = lz_stream_create();
         }
-    } else if(handle != APPFS_INVALID_FD && failed_open == false) {
-        appfsWrite(handle, written, data, length);
-        written += length;
+        if(req->lz || !(command & COMPRESSEDFLAG)) {
+            req->write_ctx = fsob_writer_open_appfs((char *) data, app_size);
+        }
+        if(req->write_ctx == NULL) {
+            req->failed = true;
+        } else if(received > data_start) {
+            fsob_request_write(req, &data[data_start], received-data_start);
+        }
+    } else if(req->write_ctx) {
+        fsob_request_write(req, data, length);
     }
 
-    if(received == size) {    //Creating an empty file or short. Close the file and send reply
-        failed_open = 0;
-        if(handle != APPFS_INVALID_FD) {
-            sendok(command, message_id);
-            handle = APPFS_INVALID_FD;
+    if(received == size) {    //Finished receiving, the writer task replies and closes the request once the app is stored
+        fsob_request_finish(req);
+    }
+    return 1;
+}
+
+/*
+* Write part of an app. Datafield is the app name, 4 byte size of the app, 4 byte offset, flags byte and the data.
+* An app that is not complete yet stays in AppFS so the next part can continue it.
+*/
+int appfswritepart(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
+        req->appfs = true;
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
+
+    if(req->write_ctx == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(received < i+1+9) {
+            if(received < size) return 0;   //Wait for the app name, size, offset and flags
         } else {
-            sender(command, message_id);
+            uint32_t app_size, offset;
+            memcpy(&app_size, &data[i+1], 4);
+            memcpy(&offset, &data[i+1+4], 4);
+            req->write_ctx = fsob_writer_open_appfs_part((char *) data, app_size, offset, data[i+1+8] & PARTFINAL);
+        }
+        if(req->write_ctx == NULL) {
+            req->failed = true;
+        } else if(received > i+1+9) {
+            fsob_request_write(req, &data[i+1+9], received-i-1-9);
         }
+    } else if(req->write_ctx) {
+        fsob_request_write(req, data, length);
+    }
+
+    if(received == size) {
+        fsob_request_finish(req);
     }
-    return 0;
+    return 1;
 }
 
-int appfsboot(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+/*
+* Read back an installed app. Datafield is the app name, response is the app image.
+* The image is sent straight from memory mapped flash, a window that can not be mapped is read through a buffer instead.
+*/
+int appfsread(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
     if(received != size) return 0;
     appfs_handle_t fd = appfsOpen((char *) data);
     if (fd == APPFS_INVALID_FD) {
         sender(command, message_id);
         return 1;
     }
-    sendok(command, message_id);
+    int app_size;
+    appfsEntryInfo(fd, NULL, &app_size);
+
+    uint8_t header[12];
+    createMessageHeader(header, command, app_size, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    for(uint32_t offset = 0; offset < app_size; offset += APPFS_MMAP_WINDOW) {
+        uint32_t window = app_size - offset < APPFS_MMAP_WINDOW ? app_size - offset : APPFS_MMAP_WINDOW;
+        const void *mapped;
+        spi_flash_mmap_handle_t handle;
+        if(appfsMmap(fd, offset, window, &mapped, SPI_FLASH_MMAP_DATA, &handle) == ESP_OK) {
+            fsob_write_bytes((const char*) mapped, window);
+            appfsMunmap(handle);
+            continue;
+        }
+        ESP_LOGW(TAG, "Failed to map %s at %d", (char *) data, offset);
+        uint8_t buffer[256];
+        for(uint32_t done = 0; done < window; ) {
+            uint32_t chunk = window - done < sizeof(buffer) ? window - done : sizeof(buffer);
+            if(appfsRead(fd, offset + done, buffer, chunk) != ESP_OK) memset(buffer, 0xFF, chunk);
+            fsob_write_bytes((const char*) buffer, chunk);
+            done += chunk;
+        }
+    }
+    fsob_tx_unlock();
+    return 1;
+}
+
+/*
+* SHA-256 of the first size bytes of an app, read from memory mapped flash.
+*/
+bool appfs_hash(appfs_handle_t fd, uint32_t size, uint8_t *hash) {
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    bool ok = true;
+    for(uint32_t offset = 0; offset < size && ok; offset += APPFS_MMAP_WINDOW) {
+        uint32_t window = size - offset < APPFS_MMAP_WINDOW ? size - offset : APPFS_MMAP_WINDOW;
+        const void *mapped;
+        spi_flash_mmap_handle_t handle;
+        ok = appfsMmap(fd, offset, window, &mapped, SPI_FLASH_MMAP_DATA, &handle) == ESP_OK;
+        if(ok) {
+            mbedtls_sha256_update_ret(&sha, mapped, window);
+            appfsMunmap(handle);
+        }
+    }
+    mbedtls_sha256_finish_ret(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    return ok;
+}
+
+/*
+* Reboot into an app. The short delay lets the reply that was just sent leave the bus.
+*/
+void appfs_boot(appfs_handle_t fd) {
     vTaskDelay(100 / portTICK_PERIOD_MS);
-     if (fd<0 || fd>255) {
+    if (fd<0 || fd>255) {
         REG_WRITE(RTC_CNTL_STORE0_REG, 0);
     } else {
         REG_WRITE(RTC_CNTL_STORE0_REG, 0xA5000000|fd);
     }
-    
+
     esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_ON);
     esp_sleep_enable_timer_wakeup(10);
     esp_deep_sleep_start();
+}
+
+/*
+* Write an app and boot it. Datafield is the app name, the 4 byte size of the app, the 32 byte SHA-256 of the app,
+* a flags byte and the app. The app is checked against the hash once stored, the reply is sent before the badge reboots.
+* With DEPLOYSKIPSAME the installed app is booted straight away when it already matches, the app data can then be left out.
+*/
+int appfsdeploy(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
+        req->appfs = true;
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
+
+    if(req->write_ctx == NULL && !req->failed && !req->skip) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        uint32_t data_start = i+1+4+APPFS_HASH_SIZE+1;
+        if(received < data_start) {
+            if(received < size) return 0;   //Wait for the app name, size, hash and flags
+            req->failed = true;
+        } else if(i >= sizeof(req->path)) {
+            req->failed = true;
+        } else {
+            uint32_t app_size;
+            memcpy(&app_size, &data[i+1], 4);
+            uint8_t *hash = &data[i+1+4];
+            strcpy(req->path, (char *) data);
+
+            if(data[data_start-1] & DEPLOYSKIPSAME) {
+                fsob_writer_sync();     //A write of the same app may still be queued
+                appfs_handle_t fd = appfsOpen(req->path);
+                int installed_size;
+                uint8_t installed_hash[APPFS_HASH_SIZE];
+                if(fd != APPFS_INVALID_FD) {
+                    appfsEntryInfo(fd, NULL, &installed_size);
+                    req->skip = installed_size == app_size && appfs_hash(fd, app_size, installed_hash) &&
+                                memcmp(installed_hash, hash, APPFS_HASH_SIZE) == 0;
+                }
+                if(req->skip) ESP_LOGI(TAG, "%s is up to date", req->path);
+            }
+            if(!req->skip && size > data_start) {
+                req->write_ctx = fsob_writer_open_appfs(req->path, app_size);
+                if(req->write_ctx) fsob_writer_set_deploy(req->write_ctx, hash);
+            }
+            if(req->write_ctx == NULL && !req->skip) {
+                req->failed = true;
+            } else if(req->write_ctx && received > data_start) {
+                fsob_request_write(req, &data[data_start], received-data_start);
+            }
+        }
+    } else if(req->write_ctx) {
+        fsob_request_write(req, data, length);
+    }
+
+    if(received == size) {
+        if(req->skip) {
+            char name[sizeof(req->path)];
+            strcpy(name, req->path);
+            fsob_request_received(req);
+            sendok(command, message_id);
+            fsob_request_close(message_id);
+            appfs_boot(appfsOpen(name));
+        } else {    //The writer task replies and boots the app once it is stored and verified
+            fsob_request_finish(req);
+        }
+    }
+    return 1;
+}
+
+int appfsboot(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+    appfs_handle_t fd = appfsOpen((char *) data);
+    if (fd == APPFS_INVALID_FD) {
+        sender(command, message_id);
+        return 1;
+    }
+    sendok(command, message_id);
+    appfs_boot(fd);
     return 1;
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 #include "include/fsob_backend.h"
 #include "include/driver_fsoverbus.h"
+#include "include/flowcontrol.h"
 #include <esp_err.h>
 #include <esp_log.h>
 
@@ -61,6 +62,7 @@ void fsob_task(void *pvParameters) {
                     }
                     memcpy(header_full, header, fetched);
                     vRingbufferReturnItem(buf_handle, header);
+                    fsob_flow_consumed(fetched);
                     if(fetched != PACKET_HEADER_SIZE) {
                         header = (uint8_t *) xRingbufferReceiveUpTo(buf_handle, &fetched_split, 10, PACKET_HEADER_SIZE-fetched);
                         if(header == NULL) {
@@ -68,6 +70,7 @@ void fsob_task(void *pvParameters) {
                         }
                         memcpy(&header_full[fetched], header, PACKET_HEADER_SIZE-fetched);
                         vRingbufferReturnItem(buf_handle, header);
+                        fsob_flow_consumed(PACKET_HEADER_SIZE-fetched);
                     }
 
                     //Check the payload header
@@ -102,6 +105,7 @@ void fsob_task(void *pvParameters) {
                     ESP_LOGD(TAG, "len: %d, recv: %d, size: %d", size, recv, data_sz);
                     handleFSCommand(data, command, message_id, size, recv, data_sz);
                     vRingbufferReturnItem(buf_handle, data);
+                    fsob_flow_consumed(data_sz);
                     if(recv == size) {
                         receiving = 0;
                         ESP_LOGD(TAG, "Packet receive complete");                
@@ -120,6 +124,7 @@ void fsob_init()  {
     if (buf_handle == NULL) {
         ESP_LOGE(TAG, "Failed to create ring buffer\n");
     }
+    fsob_flow_set_window(CONFIG_DRIVER_FSOVERBUS_NOBACKEND_HELPER_Size);
     xTaskCreatePinnedToCore(fsob_task, "fsoverbus_helper", 16000, NULL, 100, &fsob_task_handle, 0);
 }
 
@@ -0,0 +1,152 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "include/fsob_backend.h"
+#include "include/driver_fsoverbus.h"
+#include "include/batchfunctions.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+#include "include/requests.h"
+#include "include/writer.h"
+
+#define TAG "fsoveruart_batch"
+
+#define BATCH_ENTRY_HEADER_SIZE (6)
+#define BATCH_MESSAGE_ID        (0xFFFFFFFF)   //Batched commands run under an id of their own, outside the statistics of the batch
+
+/***
+ * Compound command. The datafield is a flags byte followed by a list of commands, every command is a 2 byte command id,
+ * 4 byte size and its datafield. The commands are executed in order, each one completes (including the flash write)
+ * before the next one starts. Their status replies are collected and sent back as a single reply:
+ * 4 byte amount of results followed by one result byte per command.
+ ***/
+
+//Only commands replying with a status can be batched, their reply is turned into a result code
+static bool batch_allowed(uint16_t command) {
+    switch(command) {
+        case FILEFUNCTIONSBASE+WRITEFILE:
+        case FILEFUNCTIONSBASE+DELFILE:
+        case FILEFUNCTIONSBASE+DUPLFILE:
+        case FILEFUNCTIONSBASE+MVFILE:
+        case FILEFUNCTIONSBASE+MAKEDIR:
+        case FILEFUNCTIONSBASE+APPFSDEL:
+        case FILEFUNCTIONSBASE+APPFSWRITE:
+        case FILEFUNCTIONSBASE+WRITEDELTA:
+        case FILEFUNCTIONSBASE+WRITEPART:
+        case FILEFUNCTIONSBASE+APPFSWRITEPART:
+        case (FILEFUNCTIONSBASE+WRITEFILE) | COMPRESSEDFLAG:
+        case (FILEFUNCTIONSBASE+APPFSWRITE) | COMPRESSEDFLAG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint8_t batch_run(uint16_t command, const uint8_t *data, uint32_t size) {
+    uint32_t message_id = BATCH_MESSAGE_ID;
+    if(!batch_allowed(command)) return BATCH_NOTSUPPORTED;
+    if(size == 0) return BATCH_ERROR;
+
+    uint8_t *copy = malloc(size+1);     //Functions use the data as 0 terminated string
+    if(copy == NULL) return BATCH_ERROR;
+    memcpy(copy, data, size);
+    copy[size] = 0;
+
+    char status[3];
+    fsob_status_capture(message_id);
+    dispatchFSCommand(copy, command, message_id, size, size, size);
+    fsob_request_abort_receiving();     //All data was passed, a request still waiting for more is malformed
+    fsob_writer_sync();     //Writes reply from the writer task
+    fsob_status_capture_end(status);
+    free(copy);
+
+    if(strcmp(status, "ok") == 0) return BATCH_OK;
+    if(strcmp(status, "ns") == 0) return BATCH_NOTSUPPORTED;
+    return BATCH_ERROR;
+}
+
+static void batch_execute(uint8_t *payload, uint32_t size, uint16_t command, uint32_t message_id) {
+    uint8_t *results = malloc(size/BATCH_ENTRY_HEADER_SIZE + 1);
+    if(results == NULL) {
+        sender(command, message_id);
+        return;
+    }
+
+    fsob_writer_sync();     //Replies of earlier writes can't end up in the captured statuses
+
+    uint8_t flags = payload[0];
+    uint32_t pos = 1;
+    uint32_t amount = 0;
+    bool stop = false;
+    while(pos < size) {
+        uint16_t sub_command;
+        uint32_t sub_size;
+        if(size-pos < BATCH_ENTRY_HEADER_SIZE) {    //Truncated command
+            results[amount++] = BATCH_ERROR;
+            break;
+        }
+        memcpy(&sub_command, &payload[pos], 2);
+        memcpy(&sub_size, &payload[pos+2], 4);
+        pos += BATCH_ENTRY_HEADER_SIZE;
+        if(sub_size > size-pos) {
+            results[amount++] = BATCH_ERROR;
+            break;
+        }
+
+        uint8_t result = stop ? BATCH_SKIPPED : batch_run(sub_command, &payload[pos], sub_size);
+        if(result != BATCH_OK && (flags & BATCHSTOPONERROR)) stop = true;
+        results[amount++] = result;
+        pos += sub_size;
+    }
+
+    uint8_t header[12];
+    createMessageHeader(header, command, 4+amount, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &amount, 4);
+    fsob_write_bytes((const char*) results, amount);
+    fsob_tx_unlock();
+    free(results);
+}
+
+int batch(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
+        if(size > 0 && size <= CONFIG_DRIVER_FSOVERBUS_BATCH_SIZE) {
+            req->batch = malloc(size);
+        }
+        if(req->batch == NULL) {
+            ESP_LOGI(TAG, "Can't buffer batch of %d bytes", size);
+            req->failed = true;
+        }
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
+
+    if(req->batch) {
+        memcpy(&req->batch[req->batch_fill], data, length);
+        req->batch_fill += length;
+    }
+    if(received != size) return 1;
+
+    //The batch keeps its slot until its reply is sent, so its statistics cover the batched commands
+    uint8_t *payload = req->batch;
+    req->batch = NULL;
+    fsob_request_received(req);
+
+    if(payload == NULL) {
+        sender(command, message_id);
+    } else {
+        batch_execute(payload, size, command, message_id);
+        free(payload);
+    }
+    fsob_request_close(message_id);
+    return 1;
+}
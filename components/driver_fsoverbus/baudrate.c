@@ -0,0 +1,81 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "include/fsob_backend.h"
+#include "include/baudrate.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+
+#define TAG "fsob_baud"
+
+static fsob_baud_set_t baud_set = NULL;
+static uint32_t baud_current = 0;
+static uint32_t baud_confirmed = 0;     //Last rate a heartbeat arrived at
+static bool baud_pending = false;      //Only used by the fsob task
+static TickType_t baud_switched = 0;    //Tick of the last switch, only valid while pending
+
+void fsob_baud_attach(fsob_baud_set_t set, uint32_t baud) {
+    baud_set = set;
+    baud_current = baud;
+    baud_confirmed = baud;
+}
+
+//Called by the backend from the fsob task while it waits for packets, reverts when the heartbeat is overdue
+void fsob_baud_poll(void) {
+    if(!baud_pending) return;
+    if(xTaskGetTickCount() - baud_switched < pdMS_TO_TICKS(BAUD_CONFIRM_TIMEOUT)) return;
+    baud_pending = false;
+    ESP_LOGW(TAG, "No heartbeat at %d baud, back to %d", baud_current, baud_confirmed);
+    fsob_tx_lock();
+    if(baud_set(baud_confirmed)) baud_current = baud_confirmed;
+    fsob_tx_unlock();
+}
+
+uint32_t fsob_baud_current(void) {
+    return baud_current;
+}
+
+//Called for every heartbeat, the first one after a switch keeps the new rate
+void fsob_baud_confirm(void) {
+    if(!baud_pending) return;
+    baud_pending = false;
+    baud_confirmed = baud_current;
+    ESP_LOGI(TAG, "Running at %d baud", baud_current);
+}
+
+/*
+* Datafield: 4 byte baud rate.
+* Response: ok at the current rate, afterwards the badge switches. er when the rate is out of range, ns when the backend has no baud rate.
+*/
+int setbaud(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(baud_set == NULL) {
+        sendns(command, message_id);
+        return 1;
+    }
+    uint32_t baud = 0;
+    if(size >= 4) memcpy(&baud, data, 4);
+    if(baud < BAUD_MIN || baud > BAUD_MAX) {
+        sender(command, message_id);
+        return 1;
+    }
+    fsob_tx_lock();     //Nothing else may be sent between the reply and the switch
+    sendok(command, message_id);
+    if(baud_set(baud)) {
+        ESP_LOGI(TAG, "Switched to %d baud, waiting for a heartbeat", baud);
+        baud_current = baud;
+        baud_pending = true;
+        baud_switched = xTaskGetTickCount();
+    }
+    fsob_tx_unlock();
+    return 1;
+}
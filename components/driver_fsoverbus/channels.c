@@ -0,0 +1,351 @@
+#include <sdkconfig.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "include/fsob_backend.h"
+#include "include/channels.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+
+#define TAG "fsob_channels"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#if CONFIG_DRIVER_FSOVERBUS_CHANNELS
+#define CHANNEL_FRAME_SIZE (CONFIG_DRIVER_FSOVERBUS_CHANNEL_FRAME_SIZE)
+#define CONSOLE_BUFFER     (CONFIG_DRIVER_FSOVERBUS_CONSOLE_BUFFER)
+#define CONSOLE_LOG_LINE   (256)
+
+//Console data waiting to be sent or read
+typedef struct {
+    uint8_t *data;
+    uint32_t head;
+    uint32_t fill;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t ready;    //Given when data is added
+} channel_ring_t;
+
+static fsob_channels_read_t bus_read = NULL;
+static fsob_channels_write_t bus_write = NULL;
+static bool channels_enabled = false;
+static SemaphoreHandle_t bus_lock = NULL;   //Held while a frame is written
+static channel_ring_t console_out;
+static channel_ring_t console_in;
+static uint8_t *console_frame = NULL;       //Only used with bus_lock held
+static bool console_reader = false;         //Console input is only kept while the firmware reads it
+static bool console_in_overflow = false;    //Warned about dropped input, reset once the reader caught up
+#if CONFIG_DRIVER_FSOVERBUS_CONSOLE_LOG
+static vprintf_like_t log_vprintf = NULL;   //Log output function that was installed before
+#endif
+
+//Frame being received, only used by the bus task
+static uint8_t rx_header[CHANNEL_HEADER_SIZE];
+static uint32_t rx_header_fill = 0;
+static uint8_t rx_channel;
+static uint32_t rx_remaining = 0;
+
+static bool ring_init(channel_ring_t *ring) {
+    ring->data = malloc(CONSOLE_BUFFER);
+    ring->lock = xSemaphoreCreateMutex();
+    ring->ready = xSemaphoreCreateBinary();
+    return ring->data && ring->lock && ring->ready;
+}
+
+//Store as much as fits and drop the rest. Never blocks on the bus, log output passes through here.
+static uint32_t ring_put(channel_ring_t *ring, const uint8_t *data, uint32_t length) {
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t stored = min(length, CONSOLE_BUFFER - ring->fill);
+    for(uint32_t i = 0; i < stored; i++) {
+        ring->data[(ring->head + ring->fill + i) % CONSOLE_BUFFER] = data[i];
+    }
+    ring->fill += stored;
+    xSemaphoreGive(ring->lock);
+    if(stored > 0) xSemaphoreGive(ring->ready);
+    return stored;
+}
+
+static uint32_t ring_take(channel_ring_t *ring, uint8_t *buffer, uint32_t length) {
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t taken = min(length, ring->fill);
+    for(uint32_t i = 0; i < taken; i++) {
+        buffer[i] = ring->data[(ring->head + i) % CONSOLE_BUFFER];
+    }
+    ring->head = (ring->head + taken) % CONSOLE_BUFFER;
+    ring->fill -= taken;
+    xSemaphoreGive(ring->lock);
+    return taken;
+}
+
+//Caller holds bus_lock
+static void frame_send(uint8_t channel, const uint8_t *data, uint16_t length) {
+    uint8_t header[CHANNEL_HEADER_SIZE] = {channel, channel ^ 0xFF};
+    memcpy(&header[2], &length, 2);
+    bus_write(header, CHANNEL_HEADER_SIZE);
+    bus_write(data, length);
+}
+
+//Send one frame of console output when there is any, caller holds bus_lock
+static bool console_send(void) {
+    uint32_t length = ring_take(&console_out, console_frame, CHANNEL_FRAME_SIZE);
+    if(length > 0) frame_send(CHANNEL_CONSOLE, console_frame, length);
+    return length > 0;
+}
+
+//Sends console output while the file channel is idle
+static void console_task(void *pvParameters) {
+    for(;;) {
+        xSemaphoreTake(console_out.ready, portMAX_DELAY);
+        bool sent = true;
+        while(sent) {
+            xSemaphoreTake(bus_lock, portMAX_DELAY);
+            sent = channels_enabled && console_send();
+            xSemaphoreGive(bus_lock);
+        }
+    }
+}
+
+#if CONFIG_DRIVER_FSOVERBUS_CONSOLE_LOG
+static int console_log(const char *format, va_list args) {
+    if(channels_enabled) {
+        char line[CONSOLE_LOG_LINE];
+        va_list copy;
+        va_copy(copy, args);
+        int length = vsnprintf(line, sizeof(line), format, copy);
+        va_end(copy);
+        if(length > 0) fsob_console_write(line, min(length, sizeof(line)-1));
+    }
+    return log_vprintf(format, args);
+}
+#endif
+
+void fsob_channels_init(void) {
+    bus_lock = xSemaphoreCreateMutex();
+    console_frame = malloc(CHANNEL_FRAME_SIZE);
+    if(bus_lock == NULL || console_frame == NULL || !ring_init(&console_out) || !ring_init(&console_in)) {
+        ESP_LOGE(TAG, "Failed to allocate console buffers");
+        bus_lock = NULL;
+        return;
+    }
+    xTaskCreatePinnedToCore(console_task, "fsoverbus_console", 2048, NULL, 5, NULL, 0);
+#if CONFIG_DRIVER_FSOVERBUS_CONSOLE_LOG
+    log_vprintf = esp_log_set_vprintf(console_log);
+#endif
+}
+
+void fsob_channels_attach(fsob_channels_read_t read, fsob_channels_write_t write) {
+    bus_read = read;
+    bus_write = write;
+}
+
+bool fsob_channels_enabled(void) {
+    return channels_enabled;
+}
+
+static bool rx_header_valid(void) {
+    uint16_t length;
+    memcpy(&length, &rx_header[2], 2);
+    return rx_header[1] == (rx_header[0] ^ 0xFF) && length > 0 && length <= CHANNEL_FRAME_SIZE;
+}
+
+/*
+* Read up to length bytes of the file channel, waiting at most timeout_ms. Frames of other channels that arrive in between
+* are handled on the way. Returns the amount of bytes read, -1 when the bus is closed.
+*/
+int fsob_channels_read(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    uint32_t done = 0;
+    uint32_t skipped = 0;
+    while(done < length) {
+        uint32_t elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+        if(elapsed > timeout_ms) break;
+        uint32_t wait = timeout_ms - elapsed;
+
+        int read;
+        if(rx_remaining == 0) {
+            read = bus_read(&rx_header[rx_header_fill], CHANNEL_HEADER_SIZE - rx_header_fill, wait);
+            if(read > 0) {
+                rx_header_fill += read;
+                if(rx_header_fill == CHANNEL_HEADER_SIZE && rx_header_valid()) {
+                    uint16_t frame_length;
+                    memcpy(&frame_length, &rx_header[2], 2);
+                    rx_channel = rx_header[0];
+                    rx_remaining = frame_length;
+                    rx_header_fill = 0;
+                } else if(rx_header_fill == CHANNEL_HEADER_SIZE) {     //Slide over garbage one byte at a time
+                    memmove(rx_header, &rx_header[1], CHANNEL_HEADER_SIZE-1);
+                    rx_header_fill--;
+                    skipped++;
+                }
+            }
+        } else if(rx_channel == CHANNEL_FILE) {
+            read = bus_read(&buffer[done], min(length - done, rx_remaining), wait);
+            if(read > 0) {
+                done += read;
+                rx_remaining -= read;
+            }
+        } else {
+            uint8_t scratch[64];
+            read = bus_read(scratch, min(sizeof(scratch), rx_remaining), wait);
+            if(read > 0) {
+                rx_remaining -= read;
+                if(rx_channel == CHANNEL_CONSOLE) fsob_console_input(scratch, read);    //Unknown channels are dropped
+            }
+        }
+        if(read < 0 && done == 0) return -1;
+        if(read <= 0) break;
+    }
+    if(skipped) ESP_LOGI(TAG, "Skipped %d bytes before frame header", skipped);
+    return done;
+}
+
+/*
+* Send bytes on the file channel. Every frame is followed by a frame of console output when there is any.
+*/
+void fsob_channels_write(const uint8_t *src, uint32_t length) {
+    while(length > 0) {
+        uint32_t chunk = min(length, CHANNEL_FRAME_SIZE);
+        xSemaphoreTake(bus_lock, portMAX_DELAY);
+        frame_send(CHANNEL_FILE, src, chunk);
+        console_send();
+        xSemaphoreGive(bus_lock);
+        src += chunk;
+        length -= chunk;
+    }
+}
+
+/*
+* Queue console output for the host. Returns the amount of bytes queued, 0 when channels are off or the buffer is full.
+*/
+size_t fsob_console_write(const char *data, size_t length) {
+    if(!channels_enabled) return 0;
+    return ring_put(&console_out, (const uint8_t *) data, length);
+}
+
+/*
+* Read console input from the host, waiting at most timeout_ms. Returns the amount of bytes read.
+*/
+int fsob_console_read(uint8_t *buffer, size_t length, uint32_t timeout_ms) {
+    if(bus_lock == NULL) return 0;
+    TickType_t start = xTaskGetTickCount();
+    for(;;) {
+        uint32_t read = ring_take(&console_in, buffer, length);
+        if(read > 0) {
+            console_in_overflow = false;
+            return read;
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        if(waited >= pdMS_TO_TICKS(timeout_ms)) return 0;
+        if(xSemaphoreTake(console_in.ready, pdMS_TO_TICKS(timeout_ms) - waited) != pdTRUE) return 0;
+    }
+}
+
+/*
+* Input that arrives without a reader is dropped. Only one warning is logged until the reader takes data again,
+* the warning itself goes out on the console channel.
+*/
+void fsob_console_input(const uint8_t *data, size_t length) {
+    if(bus_lock == NULL || !console_reader) return;
+    if(ring_put(&console_in, data, length) != length && !console_in_overflow) {
+        console_in_overflow = true;
+        ESP_LOGW(TAG, "Console input buffer full, input dropped");
+    }
+}
+
+/*
+* Attach or detach the firmware part that reads console input with fsob_console_read. Detaching discards unread input.
+*/
+void fsob_console_attach_reader(bool attached) {
+    if(bus_lock == NULL) return;
+    xSemaphoreTake(console_in.lock, portMAX_DELAY);
+    console_reader = attached;
+    if(!attached) {
+        console_in.head = 0;
+        console_in.fill = 0;
+    }
+    console_in_overflow = false;
+    xSemaphoreGive(console_in.lock);
+}
+
+bool fsob_console_has_reader(void) {
+    return console_reader;
+}
+
+/*
+* Datafield: optional byte, 1 (default) enables and 0 disables channels.
+* Response: 4 byte maximum frame size, sent in the framing the request used. The host has to wait for the reply.
+*/
+int channelmode(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(bus_read == NULL || bus_lock == NULL) {
+        sendns(command, message_id);
+        return 1;
+    }
+    bool enable = size == 0 || data[0] != 0;
+    uint32_t frame_size = CHANNEL_FRAME_SIZE;
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, command, 4, message_id);
+    fsob_tx_lock();     //No packet can be halfway while the framing changes
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &frame_size, 4);
+    xSemaphoreTake(bus_lock, portMAX_DELAY);
+    channels_enabled = enable;
+    rx_header_fill = 0;
+    rx_remaining = 0;
+    xSemaphoreGive(bus_lock);
+    fsob_tx_unlock();
+    ESP_LOGI(TAG, "Channels %s", enable ? "enabled" : "disabled");
+    return 1;
+}
+#else
+void fsob_channels_init(void) {
+}
+
+void fsob_channels_attach(fsob_channels_read_t read, fsob_channels_write_t write) {
+}
+
+bool fsob_channels_enabled(void) {
+    return false;
+}
+
+int fsob_channels_read(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    return 0;
+}
+
+void fsob_channels_write(const uint8_t *src, uint32_t length) {
+}
+
+size_t fsob_console_write(const char *data, size_t length) {
+    return 0;
+}
+
+int fsob_console_read(uint8_t *buffer, size_t length, uint32_t timeout_ms) {
+    return 0;
+}
+
+void fsob_console_input(const uint8_t *data, size_t length) {
+}
+
+void fsob_console_attach_reader(bool attached) {
+}
+
+bool fsob_console_has_reader(void) {
+    return false;
+}
+
+int channelmode(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+    sendns(command, message_id);
+    return 1;
+}
+#endif
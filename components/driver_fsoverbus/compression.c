@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "include/fsob_backend.h"
+#include "include/compression.h"
+
+#define TAG "fsoveruart_lz"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define LZ_HASH_BITS  (12)
+#define LZ_MIN_MATCH  (4)
+#define LZ_LAST_LITERALS (5)
+#define LZ_MATCH_LIMIT   (12)   //A match can not start in the last 12 bytes of a block
+
+static uint32_t lz_read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_write_length(uint8_t *op, uint32_t length) {
+    while(length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/*
+* Compress one block of at most LZ_BLOCK_SIZE bytes in LZ4 block format. Uses a greedy single probe match finder,
+* table must hold 1 << LZ_HASH_BITS entries. Returns the compressed length, or 0 when it does not fit in capacity.
+*/
+int lz_compress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity, uint16_t *table) {
+    if(capacity < length + length/255 + 16) return 0;   //Output is not bounds checked below
+    memset(table, 0, sizeof(uint16_t) << LZ_HASH_BITS);
+
+    uint8_t *op = dst;
+    uint32_t anchor = 0;
+    uint32_t i = 0;
+    uint32_t limit = length > LZ_MATCH_LIMIT ? length - LZ_MATCH_LIMIT : 0;
+
+    while(i < limit) {
+        uint32_t sequence = lz_read32(&src[i]);
+        uint32_t h = lz_hash(sequence);
+        uint32_t ref = table[h];    //Stored as position + 1, 0 is empty
+        table[h] = i + 1;
+        if(ref == 0 || lz_read32(&src[ref-1]) != sequence) {
+            i++;
+            continue;
+        }
+        ref--;
+
+        uint32_t match = LZ_MIN_MATCH;
+        while(i + match < length - LZ_LAST_LITERALS && src[ref + match] == src[i + match]) match++;
+
+        uint32_t literals = i - anchor;
+        uint8_t *token = op++;
+        *token = (min(literals, 15) << 4) | min(match - LZ_MIN_MATCH, 15);
+        if(literals >= 15) op = lz_write_length(op, literals - 15);
+        memcpy(op, &src[anchor], literals);
+        op += literals;
+        uint16_t offset = i - ref;
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if(match - LZ_MIN_MATCH >= 15) op = lz_write_length(op, match - LZ_MIN_MATCH - 15);
+
+        i += match;
+        anchor = i;
+    }
+
+    uint32_t literals = length - anchor;
+    *op++ = min(literals, 15) << 4;
+    if(literals >= 15) op = lz_write_length(op, literals - 15);
+    memcpy(op, &src[anchor], literals);
+    op += literals;
+    return op - dst;
+}
+
+/*
+* Decompress one LZ4 block. Returns the raw length or -1 when the block is corrupt or does not fit.
+*/
+int lz_decompress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + length;
+    uint32_t out = 0;
+
+    while(ip < end) {
+        uint8_t token = *ip++;
+        uint32_t literals = token >> 4;
+        if(literals == 15) {
+            uint8_t extra;
+            do {
+                if(ip >= end) return -1;
+                extra = *ip++;
+                literals += extra;
+            } while(extra == 255);
+        }
+        if(literals > (uint32_t) (end - ip) || literals > capacity - out) return -1;
+        memcpy(&dst[out], ip, literals);
+        ip += literals;
+        out += literals;
+        if(ip == end) break;    //Last sequence only holds literals
+
+        if(end - ip < 2) return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > out) return -1;
+
+        uint32_t match = token & 0x0F;
+        if(match == 15) {
+            uint8_t extra;
+            do {
+                if(ip >= end) return -1;
+                extra = *ip++;
+                match += extra;
+            } while(extra == 255);
+        }
+        match += LZ_MIN_MATCH;
+        if(match > capacity - out) return -1;
+        for(uint32_t i = 0; i < match; i++, out++) {    //Byte by byte, matches can overlap their own output
+            dst[out] = dst[out - offset];
+        }
+    }
+    return out;
+}
+
+/*
+* Compress up to length bytes of fptr into a block stream in out, reading the file once. The stream ends early when the file got shorter.
+* Returns the size of the stream, or 0 when it does not fit in capacity or the buffers can not be allocated.
+*/
+uint32_t lz_compressfile(FILE *fptr, uint32_t length, uint8_t *out, uint32_t capacity) {
+    uint8_t *raw = malloc(LZ_BLOCK_SIZE);
+    uint8_t *block = malloc(LZ_BLOCK_BOUND);
+    uint16_t *table = malloc(sizeof(uint16_t) << LZ_HASH_BITS);
+    if(raw == NULL || block == NULL || table == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate compression buffers");
+        free(raw);
+        free(block);
+        free(table);
+        return 0;
+    }
+
+    uint32_t total = 0;
+    uint32_t done = 0;
+    while(done < length) {
+        uint32_t raw_length = fread(raw, 1, min(LZ_BLOCK_SIZE, length - done), fptr);
+        if(raw_length == 0) break;
+
+        const uint8_t *data = block;
+        uint32_t compressed_length = lz_compress(raw, raw_length, block, LZ_BLOCK_BOUND, table);
+        uint32_t stored = compressed_length;
+        if(compressed_length == 0 || compressed_length >= raw_length) {
+            data = raw;
+            compressed_length = raw_length;
+            stored = raw_length | LZ_BLOCK_STORED;
+        }
+        if(capacity - total < LZ_BLOCK_HEADER_SIZE + compressed_length) {
+            total = 0;
+            break;
+        }
+        memcpy(&out[total], &stored, 4);
+        memcpy(&out[total+4], &raw_length, 4);
+        memcpy(&out[total+LZ_BLOCK_HEADER_SIZE], data, compressed_length);
+        total += LZ_BLOCK_HEADER_SIZE + compressed_length;
+        done += raw_length;
+        if(raw_length < LZ_BLOCK_SIZE) break;   //Short read, the file got shorter
+    }
+
+    free(raw);
+    free(block);
+    free(table);
+    return total;
+}
+
+fsob_lz_stream_t *lz_stream_create(void) {
+    fsob_lz_stream_t *stream = malloc(sizeof(fsob_lz_stream_t));
+    if(stream == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate decompression buffers");
+        return NULL;
+    }
+    stream->header_fill = 0;
+    stream->block_fill = 0;
+    return stream;
+}
+
+/*
+* Feed part of a block stream. Every completed block is decompressed and handed to the writer.
+* Returns false when the stream is corrupt.
+*/
+bool lz_stream_write(fsob_lz_stream_t *stream, fsob_write_ctx_t *ctx, const uint8_t *data, uint32_t length) {
+    while(length > 0) {
+        if(stream->header_fill < LZ_BLOCK_HEADER_SIZE) {
+            uint32_t chunk = min(LZ_BLOCK_HEADER_SIZE - stream->header_fill, length);
+            memcpy(&stream->header[stream->header_fill], data, chunk);
+            stream->header_fill += chunk;
+            data += chunk;
+            length -= chunk;
+            if(stream->header_fill < LZ_BLOCK_HEADER_SIZE) break;
+
+            memcpy(&stream->compressed_length, &stream->header[0], 4);
+            memcpy(&stream->raw_length, &stream->header[4], 4);
+            uint32_t compressed_length = stream->compressed_length & ~LZ_BLOCK_STORED;
+            if(stream->raw_length > LZ_BLOCK_SIZE || compressed_length > LZ_BLOCK_BOUND) return false;
+            stream->block_fill = 0;
+        }
+
+        uint32_t compressed_length = stream->compressed_length & ~LZ_BLOCK_STORED;
+        uint32_t chunk = min(compressed_length - stream->block_fill, length);
+        memcpy(&stream->block[stream->block_fill], data, chunk);
+        stream->block_fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if(stream->block_fill < compressed_length) break;
+
+        if(stream->compressed_length & LZ_BLOCK_STORED) {
+            if(compressed_length != stream->raw_length) return false;
+            fsob_writer_write(ctx, stream->block, compressed_length);
+        } else {
+            int raw_length = lz_decompress(stream->block, compressed_length, stream->raw, LZ_BLOCK_SIZE);
+            if(raw_length < 0 || raw_length != stream->raw_length) return false;
+            fsob_writer_write(ctx, stream->raw, raw_length);
+        }
+        stream->header_fill = 0;
+        stream->block_fill = 0;
+    }
+    return true;
+}
+
+//True when the stream ended on a block boundary
+bool lz_stream_complete(fsob_lz_stream_t *stream) {
+    return stream->header_fill == 0;
+}
@@ -0,0 +1,277 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "esp32/rom/crc.h"
+
+#include "include/fsob_backend.h"
+#include "include/driver_fsoverbus.h"
+#include "include/crcmode.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+
+#define TAG "fsob_crc"
+
+#define CRC_CHUNK_SIZE     (CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE)
+#define CRC_REORDER        (CONFIG_DRIVER_FSOVERBUS_REORDER_FRAMES)
+#define CRC_HEADER_TIMEOUT (1000)
+#define CRC_FRAME_TIMEOUT  (200)   //Silence after which the next missing frame is asked for again
+#define CRC_RETRIES        (5)
+
+static fsob_crc_read_t crc_read = NULL;
+static bool crc_enabled = false;
+
+//Bytes that have been read but not consumed yet, used to slide over garbage one byte at a time
+static uint8_t window[CRC_HEADER_SIZE];
+static uint32_t window_fill = 0;
+
+//Frames received ahead of a missing one
+static uint8_t *reorder = NULL;
+static struct {
+    bool valid;
+    uint32_t seq;
+    uint32_t length;
+} reorder_slot[CRC_REORDER];
+
+void fsob_crc_attach(fsob_crc_read_t read) {
+    crc_read = read;
+}
+
+bool fsob_crc_enabled(void) {
+    return crc_enabled;
+}
+
+static bool window_fill_to(uint32_t length, uint32_t timeout_ms) {
+    while(window_fill < length) {
+        int read = crc_read(&window[window_fill], length - window_fill, timeout_ms);
+        if(read <= 0) return false;
+        window_fill += read;
+    }
+    return true;
+}
+
+static void window_shift(uint32_t length) {
+    memmove(window, &window[length], window_fill - length);
+    window_fill -= length;
+}
+
+//Read length bytes, starting with what is left in the window
+static bool crc_read_bytes(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    uint32_t from_window = window_fill < length ? window_fill : length;
+    memcpy(buffer, window, from_window);
+    window_shift(from_window);
+    while(from_window < length) {
+        int read = crc_read(&buffer[from_window], length - from_window, timeout_ms);
+        if(read <= 0) return false;
+        from_window += read;
+    }
+    return true;
+}
+
+static bool header_valid(const uint8_t *header) {
+    if(header[6] != 0xDE || header[7] != 0xAD) return false;
+    uint32_t crc;
+    memcpy(&crc, &header[12], 4);
+    return crc32_le(0, header, 12) == crc;
+}
+
+static bool frame_check(const uint8_t *frame) {
+    uint16_t check;
+    memcpy(&check, &frame[10], 2);
+    return (crc32_le(0, frame, 10) & 0xFFFF) == check;
+}
+
+static void crc_nak(uint32_t message_id, uint32_t seq) {
+    uint8_t header[PACKET_HEADER_SIZE];
+    ESP_LOGD(TAG, "NAK %d of %d", seq, message_id);
+    createMessageHeader(header, SPECIALFUNCTIONSBASE+CRCNAK, 4, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &seq, 4);
+    fsob_tx_unlock();
+}
+
+/*
+* Wait for a valid packet header. Frames of a packet of which the header got lost are answered with a header NAK,
+* the host then sends the complete packet again.
+*/
+static bool crc_receive_header(uint16_t *command, uint32_t *size, uint32_t *message_id) {
+    static uint32_t nak_id = 0;
+    static bool nak_sent = false;
+    uint32_t skipped = 0;
+
+    for(;;) {
+        if(!window_fill_to(CRC_HEADER_SIZE, CRC_HEADER_TIMEOUT)) return false;
+        if(header_valid(window)) break;
+        if(frame_check(window)) {
+            uint32_t id;
+            memcpy(&id, &window[0], 4);
+            if(!nak_sent || nak_id != id) {
+                crc_nak(id, CRC_NAK_HEADER);
+                nak_id = id;
+                nak_sent = true;
+            }
+        }
+        window_shift(1);
+        skipped++;
+    }
+    if(skipped) ESP_LOGI(TAG, "Skipped %d bytes before packet header", skipped);
+
+    memcpy(command, &window[0], 2);
+    memcpy(size, &window[2], 4);
+    memcpy(message_id, &window[8], 4);
+    window_shift(CRC_HEADER_SIZE);
+    nak_sent = false;
+    return true;
+}
+
+static uint32_t frame_length(uint32_t size, uint32_t seq) {
+    uint32_t remaining = size - seq * CRC_CHUNK_SIZE;
+    return remaining < CRC_CHUNK_SIZE ? remaining : CRC_CHUNK_SIZE;
+}
+
+/*
+* Receive the frames of one packet and hand them to handleFSCommand in order.
+*/
+static void crc_receive_payload(uint8_t *buffer, uint16_t command, uint32_t message_id, uint32_t size) {
+    uint32_t frames = (size + CRC_CHUNK_SIZE - 1) / CRC_CHUNK_SIZE;
+    uint32_t next = 0;          //Next frame to hand over
+    uint32_t expected = 0;      //Next frame in the order the host sends them, frames before it that are missing have been NAKed
+    uint32_t received = 0;
+    int retries = 0;
+
+    for(int i = 0; i < CRC_REORDER; i++) reorder_slot[i].valid = false;
+
+    while(next < frames) {
+        if(!window_fill_to(CRC_FRAME_SIZE, CRC_FRAME_TIMEOUT)) {
+            if(++retries > CRC_RETRIES) {
+                ESP_LOGI(TAG, "Frame %d of %d did not arrive", next, message_id);
+                sendte(command, message_id);
+                return;
+            }
+            crc_nak(message_id, next);
+            continue;
+        }
+
+        uint32_t id, seq;
+        uint16_t length;
+        memcpy(&id, &window[0], 4);
+        memcpy(&seq, &window[4], 4);
+        memcpy(&length, &window[8], 2);
+        if(!frame_check(window) || id != message_id || seq >= frames || length != frame_length(size, seq)) {
+            if(window_fill_to(CRC_HEADER_SIZE, CRC_FRAME_TIMEOUT) && header_valid(window)) {
+                ESP_LOGI(TAG, "Packet %d cut off by a new packet", message_id);
+                return;     //Header stays in the window for the next packet
+            }
+            window_shift(1);
+            continue;
+        }
+        window_shift(CRC_FRAME_SIZE);
+
+        //Frames are read into the slot they will be handed over from, buffer doubles as scratch space for frames that are dropped
+        int slot = -1;
+        uint8_t *target = buffer;
+        if(seq > next && seq - next <= CRC_REORDER && !reorder_slot[seq % CRC_REORDER].valid) {
+            slot = seq % CRC_REORDER;
+            target = &reorder[slot * CRC_CHUNK_SIZE];
+        }
+        uint32_t crc;
+        if(!crc_read_bytes(target, length, CRC_FRAME_TIMEOUT) || !crc_read_bytes((uint8_t *) &crc, 4, CRC_FRAME_TIMEOUT)) {
+            crc_nak(message_id, seq);
+            continue;
+        }
+        for(; expected < seq; expected++) {     //Frames skipped over, their headers were corrupt
+            crc_nak(message_id, expected);
+        }
+        if(expected == seq) expected++;
+        if(crc32_le(0, target, length) != crc) {
+            ESP_LOGD(TAG, "CRC error in frame %d of %d", seq, message_id);
+            crc_nak(message_id, seq);
+            continue;
+        }
+        retries = 0;
+
+        if(seq < next) continue;    //Sent twice
+        if(seq > next) {
+            if(reorder_slot[seq % CRC_REORDER].valid && reorder_slot[seq % CRC_REORDER].seq == seq) continue;    //Sent twice
+            if(slot < 0) {
+                crc_nak(message_id, seq);   //No room to keep it, ask again later
+            } else {
+                reorder_slot[slot].valid = true;
+                reorder_slot[slot].seq = seq;
+                reorder_slot[slot].length = length;
+            }
+            continue;
+        }
+
+        received += length;
+        handleFSCommand(buffer, command, message_id, size, received, length);
+        next++;
+        for(;;) {
+            slot = next % CRC_REORDER;
+            if(!reorder_slot[slot].valid || reorder_slot[slot].seq != next) break;
+            reorder_slot[slot].valid = false;
+            received += reorder_slot[slot].length;
+            handleFSCommand(&reorder[slot * CRC_CHUNK_SIZE], command, message_id, size, received, reorder_slot[slot].length);
+            next++;
+        }
+    }
+}
+
+/*
+* Receive and handle one packet in CRC mode. Returns after a packet was handled or when no packet started within a second.
+*/
+void fsob_crc_receive(uint8_t *buffer) {
+    uint16_t command;
+    uint32_t size, message_id;
+    if(crc_receive_header(&command, &size, &message_id)) {
+        if(size == 0) {
+            handleFSCommand(buffer, command, message_id, 0, 0, 0);
+        } else {
+            crc_receive_payload(buffer, command, message_id, size);
+        }
+    }
+    if(!crc_enabled && reorder) {   //Switched off by the packet that was just handled
+        free(reorder);
+        reorder = NULL;
+    }
+}
+
+/*
+* Datafield: optional byte, 1 (default) enables and 0 disables CRC mode.
+* Response: 4 byte frame size. Enabling takes effect for the packet after this one, the host has to wait for the reply.
+*/
+int crcmode(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(crc_read == NULL) {
+        sendns(command, message_id);
+        return 1;
+    }
+    bool enable = size == 0 || data[0] != 0;
+    if(enable && reorder == NULL) {
+        reorder = malloc(CRC_REORDER * CRC_CHUNK_SIZE);
+        if(reorder == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate reorder buffer");
+            sender(command, message_id);
+            return 1;
+        }
+    }
+    crc_enabled = enable;
+    window_fill = 0;
+    ESP_LOGI(TAG, "CRC mode %s", crc_enabled ? "enabled" : "disabled");
+
+    uint32_t frame_size = CRC_CHUNK_SIZE;
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, command, 4, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &frame_size, 4);
+    fsob_tx_unlock();
+    return 1;
+}
@@ -0,0 +1,287 @@
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "mbedtls/sha256.h"
+
+#include "include/fsob_backend.h"
+#include "include/deltafunctions.h"
+#include "include/packetutils.h"
+#include "include/requests.h"
+#include "include/writer.h"
+#include "include/appfsfunctions.h"
+
+#define TAG "fsoveruart_delta"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define DELTA_MIN_BLOCK_SIZE   (64)
+#define DELTA_STRONG_HASH_SIZE (16)    //Truncated SHA-256
+#define DELTA_ENTRY_SIZE       (4+DELTA_STRONG_HASH_SIZE)
+
+/***
+ * Block level delta sync.
+ * fileblockhash returns a weak rolling checksum and a strong hash for every block of an existing file.
+ * The host searches its new version of the file for these blocks and sends writedelta instructions,
+ * copying unchanged blocks from the existing file and sending only the data in between.
+ * The new file is built in the .tmp file and renamed when complete, like writefile.
+ ***/
+
+//rsync style checksum, the host can roll this over its file one byte at a time
+static uint32_t weak_checksum(const uint8_t *data, uint32_t length) {
+    uint32_t a = 0, b = 0;
+    for(uint32_t i = 0; i < length; i++) {
+        a += data[i];
+        b += (length - i) * data[i];
+    }
+    return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+}
+
+/***
+ * Datafield: filename, 0 terminated, followed by the 4 byte block size.
+ * Response: 4 byte file size, 4 byte block size, 4 byte amount of blocks. Then for every block a 4 byte weak checksum
+ * and the first 16 bytes of the SHA-256 of the block. The last block can be shorter than the block size.
+ ***/
+int fileblockhash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint32_t name_length = strnlen((char *) data, size);
+    uint32_t block_size = 0;
+    if(size >= name_length+1+4) {
+        memcpy(&block_size, &data[name_length+1], 4);
+    }
+    if(name_length > 240 || block_size < DELTA_MIN_BLOCK_SIZE) {
+        sender(command, message_id);
+        return 1;
+    }
+
+    char file_name[256];
+    file_name[0] = 0;
+    buildfile((char *) data, file_name);
+    FILE *fptr = fopen(file_name, "r");
+    uint8_t *block = malloc(block_size);
+    if(fptr == NULL || block == NULL) {
+        if(fptr) fclose(fptr);
+        free(block);
+        sender(command, message_id);
+        return 1;
+    }
+
+    fseek(fptr, 0, SEEK_END);
+    uint32_t file_size = ftell(fptr);
+    fseek(fptr, 0, SEEK_SET);
+    uint32_t blocks = (file_size + block_size - 1) / block_size;
+
+    uint8_t header[12];
+    createMessageHeader(header, command, 12 + blocks*DELTA_ENTRY_SIZE, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &file_size, 4);
+    fsob_write_bytes((const char*) &block_size, 4);
+    fsob_write_bytes((const char*) &blocks, 4);
+
+    mbedtls_sha256_context sha;
+    for(uint32_t i = 0; i < blocks; i++) {
+        uint32_t read_bytes = fread(block, 1, block_size, fptr);
+        uint8_t entry[4+32];
+        uint32_t weak = weak_checksum(block, read_bytes);
+        memcpy(entry, &weak, 4);
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts_ret(&sha, 0);
+        mbedtls_sha256_update_ret(&sha, block, read_bytes);
+        mbedtls_sha256_finish_ret(&sha, &entry[4]);
+        mbedtls_sha256_free(&sha);
+        fsob_write_bytes((const char*) entry, DELTA_ENTRY_SIZE);
+    }
+    fsob_tx_unlock();
+
+    fclose(fptr);
+    free(block);
+    return 1;
+}
+
+/*
+* Hash length bytes starting at offset, read through read_fn. Returns false when reading fails.
+*/
+static bool hash_range(bool (*read_fn)(void *source, uint32_t offset, uint8_t *buffer, uint32_t length), void *source,
+                       uint32_t offset, uint32_t length, uint8_t *digest) {
+    uint8_t *buffer = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    if(buffer == NULL) return false;
+
+    bool ok = true;
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    while(length > 0 && ok) {
+        uint32_t chunk = min(length, CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+        ok = read_fn(source, offset, buffer, chunk);
+        mbedtls_sha256_update_ret(&sha, buffer, chunk);
+        offset += chunk;
+        length -= chunk;
+    }
+    mbedtls_sha256_finish_ret(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    free(buffer);
+    return ok;
+}
+
+static bool hash_read_file(void *source, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    return fread(buffer, 1, length, (FILE *) source) == length;
+}
+
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+static bool hash_read_appfs(void *source, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    return appfsRead(*((appfs_handle_t *) source), offset, buffer, length) == ESP_OK;
+}
+#endif
+
+/***
+ * Datafield: 'f' followed by a filename or 'a' followed by an app name, 0 terminated. Optionally followed by a 4 byte offset
+ * and a 4 byte length to hash only part of it, a length of 0 hashes up to the end.
+ * Response: the 32 byte SHA-256.
+ ***/
+int filehash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint32_t name_length = size > 1 ? strnlen((char *) &data[1], size-1) : 0;
+    uint32_t offset = 0, range = 0;
+    if(size >= 1+name_length+1+8) {
+        memcpy(&offset, &data[1+name_length+1], 4);
+        memcpy(&range, &data[1+name_length+1+4], 4);
+    }
+    if(name_length == 0 || name_length > 240 || (data[0] != 'f' && data[0] != 'a')) {
+        sender(command, message_id);
+        return 1;
+    }
+
+    bool ok = false;
+    uint8_t digest[32];
+    if(data[0] == 'f') {
+        char file_name[256];
+        file_name[0] = 0;
+        buildfile((char *) &data[1], file_name);
+        FILE *fptr = fopen(file_name, "r");
+        if(fptr) {
+            fseek(fptr, 0, SEEK_END);
+            uint32_t file_size = ftell(fptr);
+            if(offset > file_size) offset = file_size;
+            if(range == 0 || range > file_size-offset) range = file_size-offset;
+            fseek(fptr, offset, SEEK_SET);
+            ok = hash_range(hash_read_file, fptr, offset, range, digest);
+            fclose(fptr);
+        }
+    } else {
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+        appfs_handle_t fd = appfsOpen((char *) &data[1]);
+        if(fd != APPFS_INVALID_FD) {
+            int app_size;
+            appfsEntryInfo(fd, NULL, &app_size);
+            if(offset > app_size) offset = app_size;
+            if(range == 0 || range > app_size-offset) range = app_size-offset;
+            ok = hash_range(hash_read_appfs, &fd, offset, range, digest);
+        }
+#endif
+    }
+
+    if(!ok) {
+        sender(command, message_id);
+        return 1;
+    }
+    uint8_t header[12];
+    createMessageHeader(header, command, sizeof(digest), message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) digest, sizeof(digest));
+    fsob_tx_unlock();
+    return 1;
+}
+
+static void delta_fail(fsob_request_t *req) {
+    if(req->write_ctx) fsob_writer_abort(req->write_ctx);
+    req->write_ctx = NULL;
+    req->failed = true;
+}
+
+/*
+* Execute instructions. They can be split over multiple calls, partial instructions are kept in the request.
+* 'C' + 4 byte block index + 4 byte block count: copy blocks of the existing file.
+* 'D' + 4 byte length + data: append literal data.
+*/
+static void delta_process(fsob_request_t *req, uint8_t *data, uint32_t length) {
+    while(length > 0 && req->write_ctx) {
+        if(req->literal > 0) {
+            uint32_t chunk = min(req->literal, length);
+            fsob_writer_write(req->write_ctx, data, chunk);
+            req->literal -= chunk;
+            data += chunk;
+            length -= chunk;
+            continue;
+        }
+
+        req->op[req->op_fill++] = *data++;
+        length--;
+        uint32_t needed = req->op[0] == 'C' ? 9 : (req->op[0] == 'D' ? 5 : 0);
+        if(needed == 0) {
+            ESP_LOGI(TAG, "Unknown delta instruction %d", req->op[0]);
+            delta_fail(req);
+            return;
+        }
+        if(req->op_fill < needed) continue;
+
+        req->op_fill = 0;
+        if(req->op[0] == 'C') {
+            uint32_t index, count;
+            memcpy(&index, &req->op[1], 4);
+            memcpy(&count, &req->op[5], 4);
+            fsob_writer_copy(req->write_ctx, index*req->block_size, count*req->block_size);
+        } else {
+            memcpy(&req->literal, &req->op[1], 4);
+        }
+    }
+}
+
+/***
+ * Datafield: filename, 0 terminated, followed by the 4 byte block size used for fileblockhash and the instructions.
+ * Replies ok once the new file has been stored.
+ ***/
+int writedelta(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
+
+    if(req->write_ctx == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(i == received || received < i+1+4) {
+            if(received != size) return 0;   //Wait for the filename and block size
+            req->failed = true;     //Whole packet arrived without them
+        } else {
+            memcpy(&req->block_size, &data[i+1], 4);
+            if(i <= 250 && req->block_size >= DELTA_MIN_BLOCK_SIZE) {
+                buildfile((char *) data, req->path);
+                req->write_ctx = fsob_writer_open_file((char *) data);
+            }
+            if(req->write_ctx == NULL) {
+                req->failed = true;
+            } else {
+                delta_process(req, &data[i+1+4], received-i-1-4);
+            }
+        }
+    } else if(req->write_ctx) {
+        delta_process(req, data, length);
+    }
+
+    if(received == size) {
+        if(req->literal > 0 || req->op_fill > 0) {  //Instructions were cut off
+            delta_fail(req);
+        }
+        fsob_request_finish(req);
+    }
+    return 1;
+}
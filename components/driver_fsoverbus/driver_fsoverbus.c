@@ -11,6 +11,7 @@
 #include <esp_vfs.h>
 #include <dirent.h>
 #include <esp_intr_alloc.h>
+#include <esp_timer.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -24,7 +25,20 @@
 #include "include/specialfunctions.h"
 #include "include/fsob_backend.h"
 #include "include/appfsfunctions.h"
+#include "include/deltafunctions.h"
+#include "include/batchfunctions.h"
+#include "include/partitionfunctions.h"
+#include "include/tarfunctions.h"
+#include "include/watchfunctions.h"
+#include "include/flowcontrol.h"
+#include "include/stats.h"
+#include "include/crcmode.h"
+#include "include/channels.h"
+#include "include/baudrate.h"
+#include "include/hostfs.h"
 #include "include/functions.h"
+#include "include/writer.h"
+#include "include/requests.h"
 
 #define TAG "fsob"
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -32,7 +46,7 @@
 
 TimerHandle_t timeout;
 
-uint8_t command_in[CACHE_SIZE];
+uint8_t command_in[CACHE_SIZE+1];  //One extra byte for the 0 terminator
 void fsob_timeout_function( TimerHandle_t xTimer );
 
 
@@ -41,29 +55,77 @@ void fsob_timeout_function( TimerHandle_t xTimer );
 int (*specialfunction[SPECIALFUNCTIONSLEN])(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 int (*filefunction[FILEFUNCTIONSLEN])(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 
+/*
+* Call the function registered for command. Returns the value of the function, or 0 when no function is registered.
+*/
+int dispatchFSCommand(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    uint16_t function = command & ~COMPRESSEDFLAG;
+    if(function < FILEFUNCTIONSBASE) {
+        if(function < SPECIALFUNCTIONSLEN) {
+            return specialfunction[function](data, command, message_id, size, received, length);
+        }
+    } else if(function < BADGEFUNCTIONSBASE) {
+        if((function-FILEFUNCTIONSBASE) < FILEFUNCTIONSLEN) {
+            return filefunction[function-FILEFUNCTIONSBASE](data, command, message_id, size, received, length);
+        }
+    }
+    return 0;
+}
+
+static bool compression_supported(uint16_t function) {
+    return function == FILEFUNCTIONSBASE+READFILE || function == FILEFUNCTIONSBASE+WRITEFILE || function == FILEFUNCTIONSBASE+APPFSWRITE;
+}
+
 void handleFSCommand(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
     static uint32_t write_pos;
+    static bool rejected;
     if(received == length) { //First data of the packet
         write_pos = 0;
+        rejected = false;
+        fsob_request_abort_receiving();
+        fsob_stats_begin(command, message_id, size);
     }
+    if(rejected) return;    //Rest of a packet that did not fit the cache
+    if(received == size) fsob_stats_received(message_id);
     uint8_t *buffer = command_in;
     
     if(length > CACHE_SIZE){  //Incoming buffer exceeds local cache, directly use buffer instead of copying
         buffer = data;
     } else if(length > 0) {
+        if(write_pos + length > CACHE_SIZE) {
+            ESP_LOGE(TAG, "Command %d exceeds cache, rejecting packet", command);
+            fsob_request_abort_receiving();
+            sender(command, message_id);
+            fsob_stats_end(message_id);
+            write_pos = 0;
+            rejected = true;
+            return;
+        }
         memcpy(&command_in[write_pos], data, length);
         write_pos += length;
+        command_in[write_pos] = 0;  //Keep the cache 0 terminated for functions using the data as string
     }
 
-    int return_val = 0;
-    if(command < FILEFUNCTIONSBASE) {
-        if(command < SPECIALFUNCTIONSLEN) {
-            return_val = specialfunction[command](buffer, command, message_id, size, received, length);
-        }
-    } else if(command < BADGEFUNCTIONSBASE) {
-        if((command-FILEFUNCTIONSBASE) < FILEFUNCTIONSLEN) {
-            return_val = filefunction[command-FILEFUNCTIONSBASE](buffer, command, message_id, size, received, length);
+    //Handlers get the command including the compressed flag, so replies echo it
+    uint16_t function = command & ~COMPRESSEDFLAG;
+    if((command & COMPRESSEDFLAG) && !compression_supported(function)) {
+        if(received == size) {
+            sendns(command, message_id);
+            fsob_stats_end(message_id);
         }
+        write_pos = 0;
+        return;
+    }
+
+    if(received == size) {
+        fsob_request_order(function, buffer, size);  //Wait for in flight requests this command could observe
+    }
+
+    int64_t start = esp_timer_get_time();
+    int return_val = dispatchFSCommand(buffer, command, message_id, size, received, length);
+    fsob_stats_handler(message_id, esp_timer_get_time() - start);
+    if(received == size && !fsob_request_pending(message_id)) {
+        fsob_stats_end(message_id);     //Requests still in the table are counted once their reply has been sent
     }
     if(return_val) {    //Function has indicated that next payload should write at start of buffer.
         write_pos = 0;
@@ -87,6 +149,13 @@ esp_err_t driver_fsoverbus_init(void) {
     specialfunction[EXECFILE] = execfile;
     specialfunction[HEARTBEAT] = heartbeat;
     specialfunction[PYTHONSTDIN] = pythonstdin;
+    specialfunction[FLOWCONTROL] = flowcontrol;
+    specialfunction[GETSTATS] = getstats;
+    specialfunction[RESETSTATS] = resetstats;
+    specialfunction[CRCMODE] = crcmode;
+    specialfunction[CRCNAK] = notsupported;    //Only sent by the badge
+    specialfunction[CHANNELMODE] = channelmode;
+    specialfunction[SETBAUD] = setbaud;
     
     filefunction[GETDIR] = getdir;
     filefunction[READFILE] = readfile;
@@ -95,20 +164,65 @@ esp_err_t driver_fsoverbus_init(void) {
     filefunction[DUPLFILE] = duplfile;
     filefunction[MVFILE] = mvfile;
     filefunction[MAKEDIR] = makedir;
+    filefunction[GETDIREX] = getdirex;
+    filefunction[FILEBLOCKHASH] = fileblockhash;
+    filefunction[WRITEDELTA] = writedelta;
+    filefunction[READRANGE] = readrange;
+    filefunction[WRITEPART] = writepart;
+    filefunction[WRITEOFFSET] = writeoffset;
+    filefunction[FILEHASH] = filehash;
+    filefunction[BATCH] = batch;
+    filefunction[TAREXPORT] = tarexport;
+    filefunction[TARIMPORT] = tarimport;
+    filefunction[WATCH] = watch;
+
+    #if CONFIG_DRIVER_FSOVERBUS_PARTITION_ACCESS
+    filefunction[PARTBLOCKHASH] = partblockhash;
+    filefunction[PARTREAD] = partread;
+    #else
+    filefunction[PARTBLOCKHASH] = notsupported;
+    filefunction[PARTREAD] = notsupported;
+    #endif
 
     #if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
     specialfunction[APPFSBOOT] = appfsboot;
     filefunction[APPFSDIR] = appfslist;
     filefunction[APPFSDEL] = appfsdel;
     filefunction[APPFSWRITE] = appfswrite;
+    filefunction[APPFSWRITEPART] = appfswritepart;
+    filefunction[APPFSREAD] = appfsread;
+    filefunction[APPFSDEPLOY] = appfsdeploy;
     #else
     specialfunction[APPFSBOOT] = notsupported;
     filefunction[APPFSDIR] = notsupported;
     filefunction[APPFSDEL] = notsupported;
     filefunction[APPFSWRITE] = notsupported;
+    filefunction[APPFSWRITEPART] = notsupported;
+    filefunction[APPFSREAD] = notsupported;
+    filefunction[APPFSDEPLOY] = notsupported;
     #endif
-        
+
+    #if CONFIG_DRIVER_FSOVERBUS_HOSTFS
+    filefunction[HOSTOPEN] = hostreply;
+    filefunction[HOSTREAD] = hostreply;
+    filefunction[HOSTSTAT] = hostreply;
+    filefunction[HOSTCLOSE] = hostreply;
+    #else
+    filefunction[HOSTOPEN] = notsupported;
+    filefunction[HOSTREAD] = notsupported;
+    filefunction[HOSTSTAT] = notsupported;
+    filefunction[HOSTCLOSE] = notsupported;
+    #endif
+
+    fsob_tx_init();
+    fsob_stats_init();
+    fsob_channels_init();
+    fsob_requests_init();
+    fsob_writer_init();
     fsob_init();
+    #if CONFIG_DRIVER_FSOVERBUS_HOSTFS
+    if(fsob_hostfs_init() != ESP_OK) ESP_LOGE(TAG, "Failed to mount %s", HOSTFS_MOUNT);
+    #endif
 
     ESP_LOGI(TAG, "fs over bus registered.");
     
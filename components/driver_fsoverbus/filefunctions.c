@@ -2,12 +2,17 @@
 #include <esp_log.h>
 #include <esp_vfs.h>
 #include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
 #include <esp_task_wdt.h>
 
 #include "include/fsob_backend.h"
 #include "include/filefunctions.h"
 #include "include/packetutils.h"
+#include "include/requests.h"
+#include "include/compression.h"
+#include "include/functions.h"
 
 #define TAG "fsoveruart_ff"
 
@@ -35,8 +40,10 @@ int getdir(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size,
         strcat((char *) data, root); //Append root structure
         uint8_t header[12];
         createMessageHeader(header, command, strlen((char *) data), message_id);
-        fsob_write_bytes((const char*) header, 12);
+        fsob_tx_lock();
+        fsob_write_header(header);
         fsob_write_bytes((const char*) data, strlen((char *) data));
+        fsob_tx_unlock();
         return 1;
     }
      //TODO: Fix when folder list exceeds buffer
@@ -61,8 +68,10 @@ int getdir(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size,
     uint8_t header[12];
     //ESP_LOGI(TAG, "len: %d", strlen((char *) data));
     createMessageHeader(header, command, strlen((char *) data), message_id);
-    fsob_write_bytes((const char*) header, 12);
+    fsob_tx_lock();
+    fsob_write_header(header);
     fsob_write_bytes((const char*) data, strlen((char *) data));
+    fsob_tx_unlock();
 
     return 1;
 }
@@ -81,102 +90,175 @@ int readfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size
         ESP_LOGI(TAG, "file size: %d", size_file);    
         //Create header with file size
         uint8_t header[12];
-        createMessageHeader(header, command, size_file, message_id);
-        fsob_write_bytes((const char*) header, 12);
-        
         fseek(fptr_glb, 0, SEEK_SET);
-        uint32_t read_bytes;
-        do {
-            read_bytes = fread(data, 1, 128, fptr_glb);
-            fsob_write_bytes((const char*) data, read_bytes);
-            vTaskDelay(1);  //Delay task to ensure data has time to gets flushed to webusb
-        } while(read_bytes == 128);
+        //The file is compressed once into a buffer, the header needs the size of the stream. Sent uncompressed when it does not fit.
+        uint8_t *compressed = NULL;
+        uint32_t size_compressed = 0;
+        if((command & COMPRESSEDFLAG) && size_file > 0) {
+            uint32_t capacity = size_file < CONFIG_DRIVER_FSOVERBUS_COMPRESS_BUFFER ? size_file : CONFIG_DRIVER_FSOVERBUS_COMPRESS_BUFFER;
+            compressed = malloc(capacity);
+            if(compressed) size_compressed = lz_compressfile(fptr_glb, size_file, compressed, capacity);
+            if(size_compressed == 0) fseek(fptr_glb, 0, SEEK_SET);
+        }
+        fsob_tx_lock();
+        if(size_compressed > 0) {
+            createMessageHeader(header, command, size_compressed, message_id);
+            fsob_write_header(header);
+            fsob_write_bytes((const char*) compressed, size_compressed);
+        } else {
+            createMessageHeader(header, command & ~COMPRESSEDFLAG, size_file, message_id);
+            fsob_write_header(header);
+            streamfile(fptr_glb, size_file);
+        }
+        fsob_tx_unlock();
+        free(compressed);
         fclose(fptr_glb);
     } else {
         strcpy((char *) data, "Can't open file");
         uint8_t header[12];
-        createMessageHeader(header, command, strlen((char *) data), message_id);
-        fsob_write_bytes((const char*) header, 12);
+        createMessageHeader(header, command & ~COMPRESSEDFLAG, strlen((char *) data), message_id);
+        fsob_tx_lock();
+        fsob_write_header(header);
         fsob_write_bytes((const char*) data, strlen((char *) data));
+        fsob_tx_unlock();
     }
     return 1;
 }
 
-int writefile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
-    static FILE *fptr = NULL;
-    static int failed_open = 0;
-    static char dir_name[256];
-    static char dir_name_tmp[256];
+/*
+* Read part of a file. Datafield is the filename, offset and length. A length of 0 reads up to the end of the file.
+* Response is the size of the complete file followed by the requested bytes.
+*/
+int readrange(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
 
+    uint32_t name_length = strnlen((char *) data, size);
+    uint32_t offset, range;
+    if(size < name_length+1+8 || name_length > 240) {
+        sender(command, message_id);
+        return 1;
+    }
+    memcpy(&offset, &data[name_length+1], 4);
+    memcpy(&range, &data[name_length+1+4], 4);
 
-    if(received == length) {                //Opening new file, cleaning up statics just in case
-        if(fptr) fclose(fptr);
-        failed_open = 0;
-        fptr = NULL;
+    char dir_name[256];
+    buildfile((char *) data, dir_name);
+    FILE *fptr = fopen(dir_name, "r");
+    if(fptr == NULL) {
+        sender(command, message_id);
+        return 1;
     }
+    fseek(fptr, 0, SEEK_END);
+    uint32_t size_file = ftell(fptr);
+    if(offset > size_file) offset = size_file;
+    if(range == 0 || range > size_file-offset) range = size_file-offset;
+    fseek(fptr, offset, SEEK_SET);
 
-    if(fptr == NULL && failed_open == 0) {
-        for(int i = 0; i < received; i++) {
-            if(data[i] == 0) {
-                if(i > 250) {
-                    failed_open = 1;
-                    return 1;
-                }
-                buildfile((char *) data, dir_name);
-                int len = snprintf(dir_name_tmp, 255, "%s.tmp", dir_name);
-                if (len < 0) {
-                    ESP_LOGE(TAG, "Buffer is too small");
-                }
-                ESP_LOGI(TAG, "Writing: %s", dir_name_tmp);
-
-                fptr = fopen(dir_name_tmp, "w");
-                if(fptr) {
-                    if(received > i) {
-                        fwrite(&data[i+1], 1, received-i-1, fptr);
-                    }
-                } else {
-                    ESP_LOGI(TAG, "Open failed");
-                    failed_open = 1;
-                }
-
-                if(received == size) {    //Creating an empty file or short. Close the file and send reply
-                    failed_open = 0;
-                    if(fptr) {
-                        sendok(command, message_id);
-                        fclose(fptr);
-                        remove(dir_name);
-                        rename(dir_name_tmp, dir_name);
-                        fptr = NULL;
-                    } else {
-                        sender(command, message_id);
-                    }
-                }
-                return 1;
-            }
+    uint8_t header[12];
+    createMessageHeader(header, command, 4+range, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &size_file, 4);
+    streamfile(fptr, range);
+    fsob_tx_unlock();
+    fclose(fptr);
+    return 1;
+}
+
+int writefile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {                //Opening new file
+        req = fsob_request_open(command, message_id);
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;           //Request got aborted, drop the remaining payload
+    }
+
+    if(req->write_ctx == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(i == received) return 0;   //Found no 0 terminator. File path not received. Wait for more data to arrived to get the filename
+
+        if(command & COMPRESSEDFLAG) {
+            req->lz = lz_stream_create();
         }
-        return 0;   //Found no 0 terminator. File path not received. Wait for more data to arrived to get the filename
-    } else if(fptr) {
-        ESP_LOGI(TAG, "fptr: %d %d", (uint32_t) data, length);
-        fwrite(data, 1, length, fptr);
-        if(received == size) {  //Finished receiving
-            sendok(command, message_id);
-            fclose(fptr);
-            remove(dir_name);
-            rename(dir_name_tmp, dir_name);
-            fptr = NULL;
-            failed_open = 0;            
-        } else {
-            vTaskDelay(1);
+        if(i <= 250 && (req->lz || !(command & COMPRESSEDFLAG))) {
+            buildfile((char *) data, req->path);
+            req->write_ctx = fsob_writer_open_file((char *) data);
         }
-        return 1;
+        if(req->write_ctx == NULL) {
+            req->failed = true;
+        } else if(received > i+1) {
+            fsob_request_write(req, &data[i+1], received-i-1);
+        }
+    } else if(req->write_ctx) {
+        fsob_request_write(req, data, length);
+    }
+
+    if(received == size) {  //Finished receiving, the writer task replies and closes the request once the file is stored
+        fsob_request_finish(req);
+    }
+    return 1;
+}
+
+/*
+* Write part of a file. Datafield is the filename, 4 byte offset, flags byte and the data. Parts are collected in the
+* temporary file, which is kept when a part is cut off. The part flagged PARTFINAL moves it into place.
+*/
+int writepart(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
     } else {
-        if(received == size) {
-            sender(command, message_id);
-            fptr = NULL;
-            failed_open = 0;
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;           //Request got aborted, drop the remaining payload
+    }
+
+    if(req->write_ctx == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(received < i+1+5) {
+            if(received < size) return 0;   //Wait for the filename, offset and flags
+        } else if(i <= 250) {
+            uint32_t offset;
+            memcpy(&offset, &data[i+1], 4);
+            buildfile((char *) data, req->path);
+            req->write_ctx = fsob_writer_open_file_part((char *) data, offset, data[i+1+4] & PARTFINAL);
+        }
+        if(req->write_ctx == NULL) {
+            req->failed = true;
+        } else if(received > i+1+5) {
+            fsob_request_write(req, &data[i+1+5], received-i-1-5);
         }
+    } else if(req->write_ctx) {
+        fsob_request_write(req, data, length);
+    }
+
+    if(received == size) {
+        fsob_request_finish(req);
+    }
+    return 1;
+}
+
+/*
+* Offset the next writepart or appfswritepart has to start at. Datafield is 'f' followed by the filename, or 'a' followed by the app name.
+*/
+int writeoffset(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(size < 2 || (data[0] != 'f' && data[0] != 'a') || strnlen((char *) &data[1], size-1) > 240) {
+        sender(command, message_id);
         return 1;
     }
+    uint32_t offset = fsob_writer_resume_offset((char *) &data[1], data[0] == 'a');
+
+    uint8_t header[12];
+    createMessageHeader(header, command, 4, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &offset, 4);
+    fsob_tx_unlock();
+    return 1;
 }
 
 int delfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
@@ -195,66 +277,158 @@ int delfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size,
     return 1;
 }
 
+static bool copy_file(const char *source_file, const char *dest_file) {
+    FILE *source = fopen(source_file, "r");
+    if(source == NULL) return false;
+    FILE *target = fopen(dest_file, "w");
+    if(target == NULL) {
+        fclose(source);
+        return false;
+    }
+
+    uint8_t fallback[64];
+    uint8_t *buf = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    uint32_t buf_size = CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE;
+    if(buf == NULL) {
+        buf = fallback;
+        buf_size = sizeof(fallback);
+    }
+    bool ok = true;
+    size_t read_bytes;
+    while(ok && (read_bytes = fread(buf, 1, buf_size, source)) > 0) {
+        ok = fwrite(buf, 1, read_bytes, target) == read_bytes;
+    }
+    if(buf != fallback) free(buf);
+    if(ferror(source)) ok = false;
+    fclose(source);
+    if(fclose(target) != 0) ok = false;
+    if(!ok) remove(dest_file);
+    return ok;
+}
+
+static bool is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+* Copy a file, or a directory with all its contents. Path buffers are allocated per level to keep the stack small.
+*/
+static bool copy_tree(const char *source, const char *dest) {
+    if(!is_dir(source)) return copy_file(source, dest);
+
+    if(mkdir(dest, 0775) != 0 && !is_dir(dest)) return false;
+    DIR *d = opendir(source);
+    if(d == NULL) return false;
+    char *source_entry = malloc(512);
+    char *dest_entry = malloc(512);
+    bool ok = source_entry && dest_entry;
+    struct dirent *dir;
+    while(ok && (dir = readdir(d)) != NULL) {
+        if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+        snprintf(source_entry, 512, "%s/%s", source, dir->d_name);
+        snprintf(dest_entry, 512, "%s/%s", dest, dir->d_name);
+        ok = copy_tree(source_entry, dest_entry);
+    }
+    closedir(d);
+    free(source_entry);
+    free(dest_entry);
+    return ok;
+}
+
+static bool remove_tree(const char *path) {
+    if(!is_dir(path)) return remove(path) == 0;
+
+    DIR *d = opendir(path);
+    if(d == NULL) return false;
+    char *entry = malloc(512);
+    bool ok = entry != NULL;
+    struct dirent *dir;
+    while(ok && (dir = readdir(d)) != NULL) {
+        if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+        snprintf(entry, 512, "%s/%s", path, dir->d_name);
+        ok = remove_tree(entry);
+    }
+    closedir(d);
+    free(entry);
+    return ok && rmdir(path) == 0;
+}
+
+//True when both paths are on the same mounted volume, so rename can move between them
+static bool same_volume(const char *a, const char *b) {
+    const char *end = strchr(&a[1], '/');
+    size_t len = end ? end - a : strlen(a);
+    return strncmp(a, b, len) == 0 && (b[len] == '/' || b[len] == 0);
+}
+
+/*
+* Rename source over an existing file, which FAT does not do. The old file is kept under a temporary name until
+* the source is in place and put back when that fails.
+*/
+static bool rename_over(const char *source, const char *dest) {
+    char backup[520];
+    snprintf(backup, sizeof(backup), "%s.mvtmp", dest);
+    if(rename(dest, backup) != 0) return false;
+    if(rename(source, dest) != 0) {
+        rename(backup, dest);
+        return false;
+    }
+    remove(backup);
+    return true;
+}
+
+/*
+* Copy or move a file or directory. A destination ending with "/" is a directory the source is placed in.
+* Moves within a volume are a rename, between volumes the data is copied and the source removed afterwards.
+*/
 int cpyfile(uint8_t *data, uint16_t command, uint32_t size, uint32_t received, uint32_t length, uint32_t delete_source) {
     int source_len = strlen((char *) data);
-    uint8_t *dest = &data[source_len+1];    
+    if((uint32_t) source_len+1 >= size) return 0;  //No destination
+    uint8_t *dest = &data[source_len+1];
+    while(source_len > 1 && data[source_len-1] == '/') data[--source_len] = 0;     //Directories can be given with a trailing slash
     int dest_len = strlen((char *) dest);
+    if(dest_len == 0 || source_len > 240 || dest_len > 240) return 0;
     int isfolder = dest[dest_len-1] == '/';
 
-    
-
     int filename_index = 0;
-
     for(int i = source_len-1; i > 0; i--) {
         if(data[i] == '/') {
             filename_index = i+1;
             break;
         }
     }
-
     if(filename_index == 0) { //no filename found
         return 0;
     }
-
-    uint32_t dest_file_len = dest_len + (source_len-filename_index) + 10;
-    uint8_t dest_tmp[dest_file_len];
-
+    char dest_tmp[512];
     if(isfolder) {
-        strncpy((char *) dest_tmp, (char *) dest, dest_file_len);
-        strncat((char *) dest_tmp, (char *) &data[filename_index], dest_file_len);
-        dest_len = strlen((char *) dest_tmp);
-        dest = dest_tmp;
+        snprintf(dest_tmp, sizeof(dest_tmp), "%s%s", (char *) dest, (char *) &data[filename_index]);
+        dest = (uint8_t *) dest_tmp;
     }
-
-    char source_file[source_len+30];
+    char source_file[256];
+    source_file[0] = 0;
     buildfile((char *) data, source_file);
-    char dest_file[dest_len+30];
+    char dest_file[512];
+    dest_file[0] = 0;
     buildfile((char *) dest, dest_file);
-
     ESP_LOGI(TAG, "source: %s", source_file);
     ESP_LOGI(TAG, "dest: %s", dest_file);
-
+    if(source_file[0] == 0 || dest_file[0] == 0) return 0;
     if(strcmp(source_file, dest_file) == 0) return 0;   //If dest and source are the same return error
+    size_t source_file_len = strlen(source_file);
+    if(strncmp(source_file, dest_file, source_file_len) == 0 && dest_file[source_file_len] == '/') return 0;  //Can't copy into itself
 
-    FILE *source, *target;
-    source = fopen(source_file, "r");
-    target = fopen(dest_file, "w");
-
-    if(source && target) {
-        int read_bytes;
-        uint8_t buf[64];
-        do {
-            read_bytes = fread(buf, 1, 64, source);
-            fwrite(buf, 1, read_bytes, target);
-        } while(read_bytes > 0);
-        fclose(source);
-        fclose(target);
-        if(delete_source) remove(source_file);
-        return 1;
-    } else {
-        return 0;
-    }
+    struct stat source_st;
+    if(stat(source_file, &source_st) != 0) return 0;    //Nothing is touched when the source is missing
 
+    if(delete_source && same_volume(source_file, dest_file)) {
+        struct stat dest_st;
+        bool replace = !S_ISDIR(source_st.st_mode) && stat(dest_file, &dest_st) == 0 && !S_ISDIR(dest_st.st_mode);
+        if(replace ? rename_over(source_file, dest_file) : rename(source_file, dest_file) == 0) return 1;
+    }
+    if(!copy_tree(source_file, dest_file)) return 0;
+    if(delete_source && !remove_tree(source_file)) return 0;
+    return 1;
 }
 
 int duplfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
@@ -281,6 +455,97 @@ int mvfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size,
     return 1;
 }
 
+static uint32_t getdirex_entry(uint8_t *out, uint32_t space, char type, uint32_t size, uint32_t mtime, const char *name) {
+    uint16_t name_length = strlen(name);
+    uint32_t entry_length = 1+4+4+2+name_length;
+    if(entry_length > space) return 0;
+    out[0] = type;
+    memcpy(&out[1], &size, 4);
+    memcpy(&out[5], &mtime, 4);
+    memcpy(&out[9], &name_length, 2);
+    memcpy(&out[11], name, name_length);
+    return entry_length;
+}
+
+/***
+ * Paged directory listing with metadata.
+ * Datafield: directory name, 0 terminated, optionally followed by a 4 byte cursor. The cursor is 0 for the first page.
+ * Response: 4 byte cursor for the next page (0 when the listing is complete), 4 byte amount of entries, followed by the entries.
+ * Every entry consists of a type byte ('d' or 'f'), 4 byte size, 4 byte mtime, 2 byte name length and the name.
+ * A page never exceeds CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE bytes.
+ ***/
+int getdirex(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint32_t name_length = strnlen((char *) data, size);
+    uint32_t cursor = 0;
+    if(size >= name_length+1+4) {
+        memcpy(&cursor, &data[name_length+1], 4);
+    }
+
+    uint8_t *page = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    if(page == NULL || name_length > 240) {
+        free(page);
+        sender(command, message_id);
+        return 1;
+    }
+    uint32_t page_length = 8;
+    uint32_t amount = 0;
+    uint32_t next_cursor = 0;
+
+    if(name_length <= 1) { //Requesting root
+        page_length += getdirex_entry(&page[page_length], CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE-page_length, 'd', 0, 0, "flash");
+        page_length += getdirex_entry(&page[page_length], CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE-page_length, 'd', 0, 0, "sdcard");
+        amount = 2;
+    } else {
+        char dir_name[256];
+        dir_name[0] = 0;
+        buildfile((char *) data, dir_name);
+        DIR *d = opendir(dir_name);
+        if(d == NULL) {
+            free(page);
+            sender(command, message_id);
+            return 1;
+        }
+
+        struct dirent *dir;
+        uint32_t index = 0;
+        while ((dir = readdir(d)) != NULL) {
+            if(index++ < cursor) continue;  //Skip entries already sent in previous pages
+
+            char file_name[256+sizeof(dir->d_name)];
+            snprintf(file_name, sizeof(file_name), "%s/%s", dir_name, dir->d_name);
+            struct stat st;
+            uint32_t file_size = 0, mtime = 0;
+            if(stat(file_name, &st) == 0) {
+                file_size = st.st_size;
+                mtime = st.st_mtime;
+            }
+            uint32_t entry_length = getdirex_entry(&page[page_length], CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE-page_length,
+                                                   dir->d_type == DT_DIR ? 'd' : 'f', file_size, mtime, dir->d_name);
+            if(entry_length == 0) {     //Page full, continue from this entry
+                next_cursor = index-1;
+                break;
+            }
+            page_length += entry_length;
+            amount++;
+        }
+        closedir(d);
+    }
+
+    memcpy(&page[0], &next_cursor, 4);
+    memcpy(&page[4], &amount, 4);
+
+    uint8_t header[12];
+    createMessageHeader(header, command, page_length, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) page, page_length);
+    fsob_tx_unlock();
+    free(page);
+    return 1;
+}
+
 int makedir(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
     if(received != size) return 0;
 
@@ -0,0 +1,71 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "include/fsob_backend.h"
+#include "include/flowcontrol.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+
+#define TAG "fsob_flow"
+
+static bool flow_enabled = false;
+static uint32_t flow_window = 0;       //Receive buffer size of the backend, 0 when it does not support flow control
+static uint32_t flow_consumed = 0;     //Bytes consumed since the last grant, only used by the bus task
+
+void fsob_flow_set_window(uint32_t window) {
+    flow_window = window;
+}
+
+bool fsob_flow_enabled(void) {
+    return flow_enabled;
+}
+
+static void flow_grant(uint32_t credits) {
+    uint8_t header[12];
+    createMessageHeader(header, SPECIALFUNCTIONSBASE+FLOWCONTROL, 4, 0);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &credits, 4);
+    fsob_tx_unlock();
+}
+
+/*
+* Called by the backend for every byte taken out of its receive buffer, including packet headers.
+*/
+void fsob_flow_consumed(uint32_t bytes) {
+    if(!flow_enabled) return;
+    flow_consumed += bytes;
+    if(flow_consumed >= CONFIG_DRIVER_FSOVERBUS_CREDIT_GRANT) {
+        flow_grant(flow_consumed);
+        flow_consumed = 0;
+    }
+}
+
+/*
+* Datafield: optional byte, 1 (default) enables and 0 disables flow control.
+* Response: 4 byte amount of initial credits. All bytes sent before this request have been consumed at this point,
+* the host has to wait for this reply before sending more.
+*/
+int flowcontrol(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(flow_window == 0) {
+        sendns(command, message_id);
+        return 1;
+    }
+    flow_enabled = size == 0 || data[0] != 0;
+    flow_consumed = 0;
+    ESP_LOGI(TAG, "Flow control %s, window %d", flow_enabled ? "enabled" : "disabled", flow_window);
+
+    uint8_t header[12];
+    createMessageHeader(header, command, 4, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &flow_window, 4);
+    fsob_tx_unlock();
+    return 1;
+}
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <esp_err.h>
+
+#include "appfsfunctions.h"
+#include "host_vfs.h"
+
+/***
+ * AppFS stand-in. Every app is a file in the appfs directory below the host root, new apps are filled with 0xFF
+ * like erased flash. Handles are indexes in the table of apps.
+ ***/
+
+#define APPFS_MAX_FILES 64
+
+static struct {
+    bool used;
+    char name[128];
+    int size;
+} apps[APPFS_MAX_FILES];
+//Mappings handed out by appfsMmap, the handle is the index plus one
+#define APPFS_MAX_MAPS 8
+static struct {
+    void *ptr;
+    size_t len;
+} maps[APPFS_MAX_MAPS];
+
+static pthread_mutex_t apps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void app_path(appfs_handle_t fd, char *path, size_t length) {
+    snprintf(path, length, "%s/appfs/%s", fsob_host_vfs_root(), apps[fd].name);
+}
+
+static bool valid(appfs_handle_t fd) {
+    return fd >= 0 && fd < APPFS_MAX_FILES && apps[fd].used;
+}
+
+appfs_handle_t appfsOpen(const char *filename) {
+    appfs_handle_t fd = APPFS_INVALID_FD;
+    pthread_mutex_lock(&apps_lock);
+    for(int i = 0; i < APPFS_MAX_FILES; i++) {
+        if(apps[i].used && strcmp(apps[i].name, filename) == 0) {
+            fd = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&apps_lock);
+    return fd;
+}
+
+appfs_handle_t appfsNextEntry(appfs_handle_t fd) {
+    for(int i = fd == APPFS_INVALID_FD ? 0 : fd+1; i < APPFS_MAX_FILES; i++) {
+        if(apps[i].used) return i;
+    }
+    return APPFS_INVALID_FD;
+}
+
+void appfsEntryInfo(appfs_handle_t fd, const char **name, int *size) {
+    if(name) *name = apps[fd].name;
+    if(size) *size = apps[fd].size;
+}
+
+esp_err_t appfsDeleteFile(const char *filename) {
+    appfs_handle_t fd = appfsOpen(filename);
+    if(fd == APPFS_INVALID_FD) return ESP_ERR_NOT_FOUND;
+    char path[512];
+    app_path(fd, path, sizeof(path));
+    unlink(path);
+    pthread_mutex_lock(&apps_lock);
+    apps[fd].used = false;
+    pthread_mutex_unlock(&apps_lock);
+    return ESP_OK;
+}
+
+esp_err_t appfsCreateFile(const char *filename, size_t size, appfs_handle_t *handle) {
+    if(strlen(filename) >= sizeof(apps[0].name)) return ESP_ERR_INVALID_ARG;
+    appfsDeleteFile(filename);
+
+    pthread_mutex_lock(&apps_lock);
+    appfs_handle_t fd = APPFS_INVALID_FD;
+    for(int i = 0; i < APPFS_MAX_FILES; i++) {
+        if(!apps[i].used) {
+            fd = i;
+            break;
+        }
+    }
+    if(fd == APPFS_INVALID_FD) {
+        pthread_mutex_unlock(&apps_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(apps[fd].name, filename);
+    apps[fd].size = size;
+    apps[fd].used = true;
+    pthread_mutex_unlock(&apps_lock);
+
+    char path[512];
+    app_path(fd, path, sizeof(path));
+    FILE *f = fopen(path, "w");
+    if(f == NULL) {
+        apps[fd].used = false;
+        return ESP_FAIL;
+    }
+    uint8_t erased[4096];
+    memset(erased, 0xFF, sizeof(erased));
+    for(size_t done = 0; done < size; done += sizeof(erased)) {
+        fwrite(erased, 1, size-done < sizeof(erased) ? size-done : sizeof(erased), f);
+    }
+    fclose(f);
+    *handle = fd;
+    return ESP_OK;
+}
+
+static esp_err_t app_access(appfs_handle_t fd, size_t start, void *buf, size_t len, bool write, bool erase) {
+    if(!valid(fd) || start + len > apps[fd].size) return ESP_ERR_INVALID_ARG;
+    char path[512];
+    app_path(fd, path, sizeof(path));
+    FILE *f = fopen(path, write ? "r+" : "r");
+    if(f == NULL) return ESP_FAIL;
+    fseek(f, start, SEEK_SET);
+    size_t done;
+    if(erase) {
+        uint8_t erased[4096];
+        memset(erased, 0xFF, sizeof(erased));
+        for(done = 0; done < len; ) {
+            size_t chunk = len-done < sizeof(erased) ? len-done : sizeof(erased);
+            if(fwrite(erased, 1, chunk, f) != chunk) break;
+            done += chunk;
+        }
+    } else if(write) {
+        done = fwrite(buf, 1, len, f);
+    } else {
+        done = fread(buf, 1, len, f);
+    }
+    fclose(f);
+    return done == len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t appfsErase(appfs_handle_t fd, size_t start, size_t len) {
+    if(valid(fd) && start >= apps[fd].size) return ESP_OK;     //Erasing past the end is allowed up to the allocated pages
+    if(valid(fd) && start + len > apps[fd].size) len = apps[fd].size - start;
+    return app_access(fd, start, NULL, len, true, true);
+}
+
+esp_err_t appfsWrite(appfs_handle_t fd, size_t start, uint8_t *buf, size_t len) {
+    return app_access(fd, start, buf, len, true, false);
+}
+
+esp_err_t appfsRead(appfs_handle_t fd, size_t start, void *buf, size_t len) {
+    return app_access(fd, start, buf, len, false, false);
+}
+
+//Maps the app file, offset has to be a multiple of the page size like on the badge where apps are made of MMU pages
+esp_err_t appfsMmap(appfs_handle_t fd, size_t offset, size_t len, const void** out_ptr, spi_flash_mmap_memory_t memory, spi_flash_mmap_handle_t* out_handle) {
+    if(!valid(fd) || offset + len > apps[fd].size || len == 0) return ESP_ERR_INVALID_ARG;
+    char path[512];
+    app_path(fd, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if(f == NULL) return ESP_FAIL;
+    void *ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(f), offset);
+    fclose(f);
+    if(ptr == MAP_FAILED) return ESP_FAIL;
+
+    pthread_mutex_lock(&apps_lock);
+    for(int i = 0; i < APPFS_MAX_MAPS; i++) {
+        if(maps[i].ptr == NULL) {
+            maps[i].ptr = ptr;
+            maps[i].len = len;
+            pthread_mutex_unlock(&apps_lock);
+            *out_ptr = ptr;
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&apps_lock);
+    munmap(ptr, len);
+    return ESP_ERR_NO_MEM;
+}
+
+void appfsMunmap(spi_flash_mmap_handle_t handle) {
+    if(handle == 0 || handle > APPFS_MAX_MAPS) return;
+    pthread_mutex_lock(&apps_lock);
+    munmap(maps[handle-1].ptr, maps[handle-1].len);
+    maps[handle-1].ptr = NULL;
+    pthread_mutex_unlock(&apps_lock);
+}
@@ -0,0 +1,199 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sdkconfig.h>
+
+#include "driver_fsoverbus.h"
+#include "functions.h"
+#include "host_backend.h"
+#include "host_vfs.h"
+
+/***
+ * Throughput benchmark of the fsoverbus protocol, running the component against the socket backend.
+ * Every operation is sent as a packet and waits for its reply, like a host tool without pipelining.
+ * Reports operations per second and payload MB/s for getdir, readfile, writefile and appfswrite.
+ ***/
+
+extern int fsob_host_log_level;
+
+static int client = -1;
+static uint32_t next_id = 1;
+static uint8_t *reply = NULL;
+static uint32_t reply_capacity = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_all(const void *data, size_t length) {
+    const uint8_t *p = data;
+    while(length > 0) {
+        ssize_t result = write(client, p, length);
+        if(result <= 0) {
+            perror("write");
+            exit(1);
+        }
+        p += result;
+        length -= result;
+    }
+}
+
+static void read_all(void *data, size_t length) {
+    uint8_t *p = data;
+    while(length > 0) {
+        ssize_t result = read(client, p, length);
+        if(result <= 0) {
+            perror("read");
+            exit(1);
+        }
+        p += result;
+        length -= result;
+    }
+}
+
+//Send a packet made of two parts, so payloads don't have to be copied behind a name
+static uint32_t send_packet(uint16_t command, const void *part1, uint32_t length1, const void *part2, uint32_t length2) {
+    uint8_t header[12];
+    uint32_t size = length1 + length2;
+    uint32_t id = next_id++;
+    memcpy(&header[0], &command, 2);
+    memcpy(&header[2], &size, 4);
+    header[6] = 0xDE;
+    header[7] = 0xAD;
+    memcpy(&header[8], &id, 4);
+    write_all(header, sizeof(header));
+    if(length1) write_all(part1, length1);
+    if(length2) write_all(part2, length2);
+    return id;
+}
+
+//Wait for the reply to id, returns the payload size. The payload is left in reply.
+static uint32_t read_reply(uint32_t id) {
+    for(;;) {
+        uint8_t header[12];
+        uint32_t size, reply_id;
+        read_all(header, sizeof(header));
+        memcpy(&size, &header[2], 4);
+        memcpy(&reply_id, &header[8], 4);
+        if(size > reply_capacity) {
+            reply = realloc(reply, size);
+            reply_capacity = size;
+        }
+        read_all(reply, size);
+        if(reply_id == id) return size;
+    }
+}
+
+static bool reply_ok(uint32_t size) {
+    return size == 3 && memcmp(reply, "ok", 2) == 0;
+}
+
+static void report(const char *name, uint32_t payload, uint32_t operations, double elapsed) {
+    printf("%-12s %10u %8u %12.1f %10.2f\n", name, payload, operations, operations / elapsed,
+           (double) payload * operations / elapsed / (1024*1024));
+}
+
+//Repeat an operation for at least duration seconds
+#define BENCH(name, payload, duration, operation) do { \
+    uint32_t count_ = 0; \
+    double start_ = now(), elapsed_; \
+    do { \
+        if(!(operation)) { \
+            fprintf(stderr, "%s of %u bytes failed\n", name, (unsigned) (payload)); \
+            exit(1); \
+        } \
+        count_++; \
+        elapsed_ = now() - start_; \
+    } while(elapsed_ < (duration) || count_ < 3); \
+    report(name, payload, count_, elapsed_); \
+} while(0)
+
+static bool bench_getdir(void) {
+    const char dir[] = "/flash/bench";
+    uint32_t id = send_packet(FILEFUNCTIONSBASE+GETDIR, dir, sizeof(dir), NULL, 0);
+    return read_reply(id) > 0;
+}
+
+static bool bench_writefile(const char *name, const uint8_t *data, uint32_t length) {
+    uint32_t id = send_packet(FILEFUNCTIONSBASE+WRITEFILE, name, strlen(name)+1, data, length);
+    return reply_ok(read_reply(id));
+}
+
+static bool bench_readfile(const char *name, uint32_t length) {
+    uint32_t id = send_packet(FILEFUNCTIONSBASE+READFILE, name, strlen(name)+1, NULL, 0);
+    return read_reply(id) == length;
+}
+
+static bool bench_appfswrite(const uint8_t *data, uint32_t length) {
+    const char name[] = "bench";
+    uint32_t id = send_packet(FILEFUNCTIONSBASE+APPFSWRITE, name, sizeof(name), data, length);
+    return reply_ok(read_reply(id));
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    double duration = 1.0;
+    int opt;
+    while((opt = getopt(argc, argv, "t:v")) != -1) {
+        switch(opt) {
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'v':
+                fsob_host_log_level = 4;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t seconds per measurement] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    char root[] = "/tmp/fsob_bench_XXXXXX";
+    if(mkdtemp(root) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const char *dirs[] = {"internal", "sd", "appfs", "internal/bench"};
+    for(int i = 0; i < 4; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        mkdir(path, 0775);
+    }
+    fsob_host_vfs_init(root);
+    driver_fsoverbus_init();
+    client = fsob_host_client_fd();
+
+    static const uint32_t sizes[] = {256, 4096, 65536, 1024*1024};
+    uint8_t *data = malloc(sizes[3]);
+    for(uint32_t i = 0; i < sizes[3]; i++) data[i] = (i * 7) ^ (i >> 9);    //Not trivially compressible
+
+    printf("Transfer size %d, %.1f s per measurement\n", CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE, duration);
+    printf("%-12s %10s %8s %12s %10s\n", "operation", "bytes", "ops", "ops/s", "MB/s");
+    for(int s = 0; s < 4; s++) {
+        uint32_t size = sizes[s];
+        char name[64];
+        snprintf(name, sizeof(name), "/flash/bench/file%u", size);
+        BENCH("writefile", size, duration, bench_writefile(name, data, size));
+        BENCH("readfile", size, duration, bench_readfile(name, size));
+        BENCH("appfswrite", size, duration, bench_appfswrite(data, size));
+    }
+    BENCH("getdir", 0, duration, bench_getdir());
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    free(data);
+    free(reply);
+    return 0;
+}
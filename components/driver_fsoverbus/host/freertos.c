@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+/***
+ * FreeRTOS primitives used by the component, implemented with pthreads.
+ ***/
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct host_semaphore {
+    bool recursive;
+    pthread_mutex_t mutex;      //Recursive mutexes only
+    QueueHandle_t queue;        //Binary semaphores and mutexes, a full queue is an available semaphore
+};
+
+struct host_timer {
+    TimerCallbackFunction_t callback;
+    TickType_t period;
+    bool auto_reload;
+    bool active;
+    struct timespec expiry;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+struct host_task {
+    TaskFunction_t function;
+    void *parameters;
+};
+
+//Absolute deadline for a timeout in ticks, false when waiting forever
+static bool deadline(TickType_t ticks, struct timespec *ts) {
+    if(ticks == portMAX_DELAY) return false;
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ticks / 1000;
+    ts->tv_nsec += (ticks % 1000) * 1000000L;
+    if(ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+    return true;
+}
+
+//Wait until condition holds. The lock is held on entry and exit, returns false on timeout.
+#define QUEUE_WAIT(queue, condition, ticks) ({ \
+    struct timespec ts_; \
+    bool timed_ = deadline(ticks, &ts_); \
+    bool ok_ = true; \
+    while(!(condition)) { \
+        if((ticks) == 0) { ok_ = false; break; } \
+        if(timed_) { \
+            if(pthread_cond_timedwait(&(queue)->changed, &(queue)->lock, &ts_) == ETIMEDOUT && !(condition)) { ok_ = false; break; } \
+        } else { \
+            pthread_cond_wait(&(queue)->changed, &(queue)->lock); \
+        } \
+    } \
+    ok_; })
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t queue = calloc(1, sizeof(struct host_queue));
+    if(queue == NULL) return NULL;
+    queue->items = malloc(length * (item_size ? item_size : 1));
+    if(queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    pthread_mutex_lock(&queue->lock);
+    if(!QUEUE_WAIT(queue, queue->count < queue->length, ticks)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFALSE;
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    if(queue->item_size) memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks) {
+    pthread_mutex_lock(&queue->lock);
+    if(!QUEUE_WAIT(queue, queue->count > 0, ticks)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFALSE;
+    }
+    if(queue->item_size) memcpy(buffer, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+static SemaphoreHandle_t semaphore_create(bool available) {
+    SemaphoreHandle_t semaphore = calloc(1, sizeof(struct host_semaphore));
+    if(semaphore == NULL) return NULL;
+    semaphore->queue = xQueueCreate(1, 0);
+    if(semaphore->queue == NULL) {
+        free(semaphore);
+        return NULL;
+    }
+    if(available) xQueueSend(semaphore->queue, NULL, 0);
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return semaphore_create(false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return semaphore_create(true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+    SemaphoreHandle_t semaphore = calloc(1, sizeof(struct host_semaphore));
+    if(semaphore == NULL) return NULL;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&semaphore->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    semaphore->recursive = true;
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    if(semaphore->recursive) {
+        pthread_mutex_destroy(&semaphore->mutex);
+    } else {
+        vQueueDelete(semaphore->queue);
+    }
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    return xQueueReceive(semaphore->queue, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return xQueueSend(semaphore->queue, NULL, 0);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    if(ticks != portMAX_DELAY) {
+        struct timespec ts;
+        deadline(ticks, &ts);
+        return pthread_mutex_timedlock(&semaphore->mutex, &ts) == 0;
+    }
+    return pthread_mutex_lock(&semaphore->mutex) == 0;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    return pthread_mutex_unlock(&semaphore->mutex) == 0;
+}
+
+static void *task_entry(void *argument) {
+    struct host_task task = *((struct host_task *) argument);
+    free(argument);
+    task.function(task.parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    struct host_task *task = malloc(sizeof(struct host_task));
+    if(task == NULL) return pdFAIL;
+    task->function = function;
+    task->parameters = parameters;
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, task_entry, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if(handle) *handle = NULL;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(function, name, stack_depth, parameters, priority, handle, 0);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if(task == NULL) pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    usleep(ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//Every timer has its own thread that sleeps until the timer expires
+static void *timer_thread(void *argument) {
+    TimerHandle_t timer = argument;
+    pthread_mutex_lock(&timer->lock);
+    for(;;) {
+        if(!timer->active) {
+            pthread_cond_wait(&timer->changed, &timer->lock);
+        } else if(pthread_cond_timedwait(&timer->changed, &timer->lock, &timer->expiry) == ETIMEDOUT) {
+            timer->active = timer->auto_reload;
+            if(timer->active) deadline(timer->period, &timer->expiry);
+            pthread_mutex_unlock(&timer->lock);
+            timer->callback(timer);
+            pthread_mutex_lock(&timer->lock);
+        }
+    }
+    return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *id, TimerCallbackFunction_t callback) {
+    TimerHandle_t timer = calloc(1, sizeof(struct host_timer));
+    if(timer == NULL) return NULL;
+    timer->callback = callback;
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_cond_init(&timer->changed, NULL);
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, timer_thread, timer) != 0) {
+        free(timer);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks) {
+    pthread_mutex_lock(&timer->lock);
+    timer->active = true;
+    deadline(timer->period, &timer->expiry);
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks) {
+    return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks) {
+    pthread_mutex_lock(&timer->lock);
+    timer->active = false;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
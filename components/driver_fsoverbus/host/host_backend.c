@@ -0,0 +1,151 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <sdkconfig.h>
+#include "driver_fsoverbus.h"
+#include "host_backend.h"
+#include "flowcontrol.h"
+#include "crcmode.h"
+#include "channels.h"
+
+#define HOST_WINDOW (16*1024)   //Credits advertised to the client, the socket itself never drops bytes
+
+#define TAG "fsob_host"
+#define PACKET_HEADER_SIZE 12   //packetutils.h can't be included next to sys/socket.h, both declare sendto
+
+static int sockets[2] = {-1, -1};    //0 is the client end, 1 the badge end
+
+static bool read_full(int fd, uint8_t *buffer, size_t length) {
+    while(length > 0) {
+        ssize_t result = read(fd, buffer, length);
+        if(result < 0 && errno == EINTR) continue;
+        if(result <= 0) return false;
+        buffer += result;
+        length -= result;
+    }
+    return true;
+}
+
+static void write_full(int fd, const uint8_t *buffer, size_t length) {
+    while(length > 0) {
+        ssize_t result = write(fd, buffer, length);
+        if(result < 0 && errno == EINTR) continue;
+        if(result <= 0) return;
+        buffer += result;
+        length -= result;
+    }
+}
+
+static int host_read_raw(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    struct pollfd pfd = {.fd = sockets[1], .events = POLLIN};
+    if(poll(&pfd, 1, timeout_ms) <= 0) return 0;
+    ssize_t result = read(sockets[1], buffer, length);
+    if(result == 0) return -1;
+    if(result < 0) return 0;
+    fsob_flow_consumed(result);
+    return result;
+}
+
+static void host_write_raw(const uint8_t *src, uint32_t length) {
+    write_full(sockets[1], src, length);
+}
+
+//Read from the file channel when channels are enabled
+static int host_read(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    if(fsob_channels_enabled()) return fsob_channels_read(buffer, length, timeout_ms);
+    return host_read_raw(buffer, length, timeout_ms);
+}
+
+static bool bus_read_full(uint8_t *buffer, size_t length) {
+    if(!fsob_channels_enabled()) {
+        if(!read_full(sockets[1], buffer, length)) return false;
+        fsob_flow_consumed(length);
+        return true;
+    }
+    while(length > 0) {
+        int result = fsob_channels_read(buffer, length, 1000);
+        if(result < 0) return false;
+        buffer += result;
+        length -= result;
+    }
+    return true;
+}
+
+//Same flow as the naive UART backend, the payload is handed over in CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE chunks
+static void fsob_task(void *pvParameter) {
+    uint8_t *buffer = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    uint8_t header[PACKET_HEADER_SIZE];
+    while(buffer) {
+        if(fsob_crc_enabled()) {
+            fsob_crc_receive(buffer);
+            continue;
+        }
+        if(!bus_read_full(header, sizeof(header))) break;
+        uint16_t command, verif;
+        uint32_t size, message_id;
+        memcpy(&command, &header[0], 2);
+        memcpy(&size, &header[2], 4);
+        memcpy(&verif, &header[6], 2);
+        memcpy(&message_id, &header[8], 4);
+        if(verif != 0xADDE) {
+            ESP_LOGE(TAG, "Packet header not correct");
+            continue;
+        }
+
+        if(size == 0) {
+            handleFSCommand(buffer, command, message_id, 0, 0, 0);
+            continue;
+        }
+        uint32_t received = 0;
+        while(received < size) {
+            uint32_t chunk = size - received;
+            if(chunk > CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE) chunk = CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE;
+            if(!bus_read_full(buffer, chunk)) break;
+            received += chunk;
+            handleFSCommand(buffer, command, message_id, size, received, chunk);
+        }
+    }
+    free(buffer);
+    vTaskDelete(NULL);
+}
+
+void fsob_init() {
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        ESP_LOGE(TAG, "Failed to create socket pair");
+        return;
+    }
+    fsob_flow_set_window(HOST_WINDOW);
+    fsob_crc_attach(host_read);
+    fsob_channels_attach(host_read_raw, host_write_raw);
+    xTaskCreatePinnedToCore(fsob_task, "fsoverbus_host", 16000, NULL, 100, NULL, 0);
+}
+
+void fsob_reset() {
+
+}
+
+void fsob_write_bytes(const char *src, size_t size) {
+    if(fsob_channels_enabled()) {
+        fsob_channels_write((const uint8_t *) src, size);
+    } else {
+        host_write_raw((const uint8_t *) src, size);
+    }
+}
+
+//Inject bytes as if they arrived on the bus
+void fsob_receive_bytes(uint8_t *data, size_t len) {
+    write_full(sockets[0], data, len);
+}
+
+int fsob_host_client_fd(void) {
+    return sockets[0];
+}
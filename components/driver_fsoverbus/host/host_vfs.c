@@ -0,0 +1,93 @@
+#define HOST_VFS_IMPL
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_vfs.h"
+
+#define VFS_MOUNTS 4
+
+static char vfs_root[PATH_MAX] = ".";
+static struct {
+    char base_path[16];
+    esp_vfs_t vfs;
+} vfs_mounts[VFS_MOUNTS];
+static int vfs_mount_count = 0;
+
+void fsob_host_vfs_init(const char *root) {
+    snprintf(vfs_root, sizeof(vfs_root), "%s", root);
+}
+
+const char *fsob_host_vfs_root(void) {
+    return vfs_root;
+}
+
+//Registered VFS are only kept, the component sources do not go through them on the host
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx) {
+    if(vfs_mount_count == VFS_MOUNTS || strlen(base_path) >= sizeof(vfs_mounts[0].base_path)) return ESP_ERR_NO_MEM;
+    snprintf(vfs_mounts[vfs_mount_count].base_path, sizeof(vfs_mounts[0].base_path), "%s", base_path);
+    vfs_mounts[vfs_mount_count].vfs = *vfs;
+    vfs_mount_count++;
+    return ESP_OK;
+}
+
+const esp_vfs_t *fsob_host_vfs_find(const char *base_path) {
+    for(int i = 0; i < vfs_mount_count; i++) {
+        if(strcmp(vfs_mounts[i].base_path, base_path) == 0) return &vfs_mounts[i].vfs;
+    }
+    return NULL;
+}
+
+//Map a badge path to the host directory, returns path itself when it is not on a badge mount point
+static const char *vfs_map(const char *path, char *mapped) {
+    if(strncmp(path, "/internal", 9) == 0 || strncmp(path, "/sd", 3) == 0) {
+        snprintf(mapped, PATH_MAX, "%s%s", vfs_root, path);
+        return mapped;
+    }
+    return path;
+}
+
+FILE *host_fopen(const char *path, const char *mode) {
+    char mapped[PATH_MAX];
+    return fopen(vfs_map(path, mapped), mode);
+}
+
+DIR *host_opendir(const char *path) {
+    char mapped[PATH_MAX];
+    return opendir(vfs_map(path, mapped));
+}
+
+int host_stat(const char *path, struct stat *st) {
+    char mapped[PATH_MAX];
+    return stat(vfs_map(path, mapped), st);
+}
+
+int host_mkdir(const char *path, mode_t mode) {
+    char mapped[PATH_MAX];
+    return mkdir(vfs_map(path, mapped), mode);
+}
+
+int host_rmdir(const char *path) {
+    char mapped[PATH_MAX];
+    return rmdir(vfs_map(path, mapped));
+}
+
+int host_remove(const char *path) {
+    char mapped[PATH_MAX];
+    return remove(vfs_map(path, mapped));
+}
+
+int host_unlink(const char *path) {
+    char mapped[PATH_MAX];
+    return unlink(vfs_map(path, mapped));
+}
+
+int host_rename(const char *from, const char *to) {
+    char mapped_from[PATH_MAX], mapped_to[PATH_MAX];
+    return rename(vfs_map(from, mapped_from), vfs_map(to, mapped_to));
+}
+
+int host_utime(const char *path, const struct utimbuf *times) {
+    char mapped[PATH_MAX];
+    return utime(vfs_map(path, mapped), times);
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_GPIO_H
+#define HOST_DRIVER_GPIO_H
+
+//Not used by the host build
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_UART_H
+#define HOST_DRIVER_UART_H
+
+//The host build uses a socket backend instead of a UART
+
+#endif
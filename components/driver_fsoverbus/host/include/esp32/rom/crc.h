@@ -0,0 +1,9 @@
+#ifndef HOST_ROM_CRC_H
+#define HOST_ROM_CRC_H
+
+#include <stdint.h>
+
+//Same result as the ESP32 ROM function: standard CRC32, crc is the result of the previous block
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_INTR_ALLOC_H
+#define HOST_ESP_INTR_ALLOC_H
+
+//Not used by the host build
+
+#endif
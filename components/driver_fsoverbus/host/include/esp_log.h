@@ -0,0 +1,21 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+//0 none, 1 error, 2 warning, 3 info, 4 debug. Set by the host program, defaults to warnings only.
+extern int fsob_host_log_level;
+
+#define HOST_LOG(level, letter, tag, format, ...) do { if(fsob_host_log_level >= level) fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__); } while(0)
+#define ESP_LOGE(tag, format, ...) HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(5, "V", tag, format, ##__VA_ARGS__)
+
+//Log output does not pass through the hook on the host
+typedef int (*vprintf_like_t)(const char *, va_list);
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOST_ESP_SLEEP_H
+#define HOST_ESP_SLEEP_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_PD_DOMAIN_RTC_SLOW_MEM,
+} esp_sleep_pd_domain_t;
+
+typedef enum {
+    ESP_PD_OPTION_ON,
+} esp_sleep_pd_option_t;
+
+//Rebooting into another app is not possible on the host, these only log
+void esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option);
+void esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+void esp_deep_sleep_start(void);
+void esp_deep_sleep(uint64_t time_in_us);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_ESP_SPI_FLASH_H
+#define HOST_ESP_SPI_FLASH_H
+
+#include <stdint.h>
+
+#define SPI_FLASH_SEC_SIZE      4096
+#define SPI_FLASH_MMU_PAGE_SIZE 0x10000
+
+typedef enum {
+    SPI_FLASH_MMAP_DATA,
+    SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+#endif
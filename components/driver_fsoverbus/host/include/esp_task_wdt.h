@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_TASK_WDT_H
+#define HOST_ESP_TASK_WDT_H
+
+//Not used by the host build
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_ESP_VFS_H
+#define HOST_ESP_VFS_H
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <esp_err.h>
+
+//Only the calls used by hostfs.c, the component sources use the host VFS redirection otherwise
+
+#define ESP_VFS_FLAG_DEFAULT 0
+
+typedef struct {
+    int flags;
+    ssize_t (*write)(int fd, const void *data, size_t size);
+    off_t (*lseek)(int fd, off_t size, int mode);
+    ssize_t (*read)(int fd, void *dst, size_t size);
+    int (*open)(const char *path, int flags, int mode);
+    int (*close)(int fd);
+    int (*fstat)(int fd, struct stat *st);
+    int (*stat)(const char *path, struct stat *st);
+} esp_vfs_t;
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx);
+
+#endif
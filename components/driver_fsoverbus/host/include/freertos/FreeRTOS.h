@@ -0,0 +1,26 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/***
+ * Minimal FreeRTOS API on top of pthreads, covering what the fsoverbus component uses.
+ * One tick is one millisecond.
+ ***/
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  1
+#define portMAX_DELAY       ((TickType_t) 0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms)   ((TickType_t) (ms))
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_FREERTOS_RINGBUF_H
+#define HOST_FREERTOS_RINGBUF_H
+
+//Not used by the host build
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_BACKEND_H
+#define HOST_BACKEND_H
+
+/***
+ * Socket backend of the host build. fsob_init creates a socket pair, the bus task reads packets from one end and writes
+ * replies to it. The other end is returned by fsob_host_client_fd and behaves like the host side of the UART.
+ ***/
+
+int fsob_host_client_fd(void);
+
+#endif
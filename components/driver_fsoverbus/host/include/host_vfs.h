@@ -0,0 +1,44 @@
+#ifndef HOST_VFS_H
+#define HOST_VFS_H
+
+/***
+ * Included in front of every component source. Redirects the /internal and /sd mount points to directories below
+ * the root passed to fsob_host_vfs_init, other paths are used unchanged.
+ ***/
+
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+#include <esp_vfs.h>
+
+void fsob_host_vfs_init(const char *root);
+const char *fsob_host_vfs_root(void);
+//VFS registered with esp_vfs_register at base_path, NULL when there is none
+const esp_vfs_t *fsob_host_vfs_find(const char *base_path);
+
+FILE *host_fopen(const char *path, const char *mode);
+DIR *host_opendir(const char *path);
+int host_stat(const char *path, struct stat *st);
+int host_mkdir(const char *path, mode_t mode);
+int host_rmdir(const char *path);
+int host_remove(const char *path);
+int host_unlink(const char *path);
+int host_rename(const char *from, const char *to);
+int host_utime(const char *path, const struct utimbuf *times);
+
+#ifndef HOST_VFS_IMPL
+#define fopen(path, mode) host_fopen(path, mode)
+#define opendir(path) host_opendir(path)
+#define stat(path, st) host_stat(path, st)
+#define mkdir(path, mode) host_mkdir(path, mode)
+#define rmdir(path) host_rmdir(path)
+#define remove(path) host_remove(path)
+#define unlink(path) host_unlink(path)
+#define rename(from, to) host_rename(from, to)
+#define utime(path, times) host_utime(path, times)
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+/***
+ * Configuration of the host build. Values can be overridden from the make command line, for example
+ * make CFLAGS_EXTRA=-DCONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE=16384
+ ***/
+
+#define CONFIG_DRIVER_FSOVERBUS_ENABLE 1
+#define CONFIG_DRIVER_FSOVERBUS_BACKEND 0
+#define CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT 1
+#define CONFIG_DRIVER_FSOVERBUS_STATS 1
+#define CONFIG_DRIVER_FSOVERBUS_CHANNELS 1
+#define CONFIG_DRIVER_FSOVERBUS_CONSOLE_LOG 1
+#define CONFIG_DRIVER_FSOVERBUS_WATCH 1
+#define CONFIG_DRIVER_FSOVERBUS_PARTITION_ACCESS 1
+#define CONFIG_DRIVER_FSOVERBUS_PARTITION_LABELS "locfd appfs"
+#define CONFIG_DRIVER_FSOVERBUS_HOSTFS 1
+
+#ifndef CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE
+#define CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE 4096
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_WRITER_BUFFERS
+#define CONFIG_DRIVER_FSOVERBUS_WRITER_BUFFERS 4
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS
+#define CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS 8
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_CREDIT_GRANT
+#define CONFIG_DRIVER_FSOVERBUS_CREDIT_GRANT 2048
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_REORDER_FRAMES
+#define CONFIG_DRIVER_FSOVERBUS_REORDER_FRAMES 4
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_CHANNEL_FRAME_SIZE
+#define CONFIG_DRIVER_FSOVERBUS_CHANNEL_FRAME_SIZE 512
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_CONSOLE_BUFFER
+#define CONFIG_DRIVER_FSOVERBUS_CONSOLE_BUFFER 2048
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_WATCH_INTERVAL
+#define CONFIG_DRIVER_FSOVERBUS_WATCH_INTERVAL 1000
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_WATCH_ENTRIES
+#define CONFIG_DRIVER_FSOVERBUS_WATCH_ENTRIES 256
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_HOSTFS_FILES
+#define CONFIG_DRIVER_FSOVERBUS_HOSTFS_FILES 4
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_HOSTFS_TIMEOUT
+#define CONFIG_DRIVER_FSOVERBUS_HOSTFS_TIMEOUT 2000
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_BATCH_SIZE
+#define CONFIG_DRIVER_FSOVERBUS_BATCH_SIZE 65536
+#endif
+#ifndef CONFIG_DRIVER_FSOVERBUS_COMPRESS_BUFFER
+#define CONFIG_DRIVER_FSOVERBUS_COMPRESS_BUFFER 262144
+#endif
+
+#endif
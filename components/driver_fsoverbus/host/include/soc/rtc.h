@@ -0,0 +1,6 @@
+#ifndef HOST_SOC_RTC_H
+#define HOST_SOC_RTC_H
+
+//Not used by the host build
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef HOST_SOC_RTC_CNTL_REG_H
+#define HOST_SOC_RTC_CNTL_REG_H
+
+#define RTC_CNTL_STORE0_REG 0
+#define REG_WRITE(reg, value) ((void) (reg), (void) (value))
+
+#endif
@@ -0,0 +1,56 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_partition.h"
+#include "host_vfs.h"
+
+/***
+ * Flash partition stand-in, every partition is a file in the partitions directory below the host root.
+ ***/
+
+#define PARTITION_MAX 8
+
+static esp_partition_t partitions[PARTITION_MAX];
+static int partition_count = 0;
+static pthread_mutex_t partitions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void partition_path(const char *label, char *path, size_t length) {
+    snprintf(path, length, "%s/partitions/%s", fsob_host_vfs_root(), label);
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    char path[512];
+    struct stat st;
+    if(label == NULL || strlen(label) >= sizeof(partitions[0].label)) return NULL;
+    partition_path(label, path, sizeof(path));
+    if(stat(path, &st) != 0) return NULL;
+
+    esp_partition_t *partition = NULL;
+    pthread_mutex_lock(&partitions_lock);
+    for(int i = 0; i < partition_count; i++) {
+        if(strcmp(partitions[i].label, label) == 0) partition = &partitions[i];
+    }
+    if(partition == NULL && partition_count < PARTITION_MAX) {
+        partition = &partitions[partition_count++];
+        strcpy(partition->label, label);
+        partition->type = ESP_PARTITION_TYPE_DATA;
+        partition->subtype = ESP_PARTITION_SUBTYPE_ANY;
+    }
+    if(partition) partition->size = st.st_size;
+    pthread_mutex_unlock(&partitions_lock);
+    return partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    char path[512];
+    if(src_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    partition_path(partition->label, path, sizeof(path));
+    FILE *fptr = fopen(path, "r");
+    if(fptr == NULL) return ESP_FAIL;
+    size_t read_bytes = 0;
+    if(fseek(fptr, src_offset, SEEK_SET) == 0) read_bytes = fread(dst, 1, size, fptr);
+    fclose(fptr);
+    return read_bytes == size ? ESP_OK : ESP_FAIL;
+}
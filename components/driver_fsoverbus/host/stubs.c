@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+
+int fsob_host_log_level = 2;
+
+void esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option) {
+}
+
+void esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+}
+
+void esp_deep_sleep_start(void) {
+    ESP_LOGI("host", "Deep sleep requested, ignored on the host");
+}
+
+void esp_deep_sleep(uint64_t time_in_us) {
+    esp_deep_sleep_start();
+}
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func) {
+    return vprintf;
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
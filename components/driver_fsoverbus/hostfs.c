@@ -0,0 +1,266 @@
+#include <sdkconfig.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_vfs.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "include/fsob_backend.h"
+#include "include/functions.h"
+#include "include/hostfs.h"
+#include "include/packetutils.h"
+
+#define TAG "fsob_hostfs"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define HOSTFS_FILES   (CONFIG_DRIVER_FSOVERBUS_HOSTFS_FILES)
+#define HOSTFS_TIMEOUT (CONFIG_DRIVER_FSOVERBUS_HOSTFS_TIMEOUT)
+#define HOSTFS_STATUS_SIZE (4)
+
+typedef struct {
+    bool in_use;
+    uint32_t handle;    //Handle given by the host
+    uint32_t size;
+    uint32_t mtime;
+    off_t pos;
+} hostfs_file_t;
+
+static hostfs_file_t files[HOSTFS_FILES];
+static SemaphoreHandle_t hostfs_mutex = NULL;   //Held for every call, only one is on the bus at a time
+
+//Answer being waited for, written by the bus task
+static SemaphoreHandle_t reply_lock = NULL;
+static SemaphoreHandle_t reply_done = NULL;
+static bool reply_waiting = false;
+static uint16_t reply_command;
+static uint32_t reply_id;
+static uint8_t reply_status[HOSTFS_STATUS_SIZE];
+static uint8_t *reply_data;
+static uint32_t reply_capacity;
+static uint32_t reply_size;
+static uint32_t next_id = 0x80000000;    //Kept apart from the message ids the host uses
+
+/*
+* The answer starts with a 4 byte status (0 or an errno value), the rest is copied to the buffer of the waiting call.
+*/
+int hostreply(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(reply_lock == NULL) return 1;
+    xSemaphoreTake(reply_lock, portMAX_DELAY);
+    if(reply_waiting && command == reply_command && message_id == reply_id) {
+        uint32_t offset = received - length;
+        uint32_t status = offset < HOSTFS_STATUS_SIZE ? min(HOSTFS_STATUS_SIZE - offset, length) : 0;
+        memcpy(&reply_status[offset < HOSTFS_STATUS_SIZE ? offset : 0], data, status);
+        if(status < length) {
+            uint32_t pos = offset + status - HOSTFS_STATUS_SIZE;
+            if(pos < reply_capacity) memcpy(&reply_data[pos], &data[status], min(length - status, reply_capacity - pos));
+        }
+        if(received == size) {
+            reply_size = size;
+            reply_waiting = false;
+            xSemaphoreGive(reply_done);
+        }
+    } else if(received == size) {
+        ESP_LOGW(TAG, "Dropped answer %d, nothing is waiting for it", message_id);
+    }
+    xSemaphoreGive(reply_lock);
+    return 1;
+}
+
+/*
+* Send a request to the host and wait for the answer, caller holds hostfs_mutex.
+* Returns the amount of bytes answered after the status, -1 with errno set on failure.
+*/
+static int hostfs_call(uint16_t function, const void *request, uint32_t request_size, void *reply, uint32_t capacity) {
+    uint16_t command = FILEFUNCTIONSBASE + function;
+    xSemaphoreTake(reply_lock, portMAX_DELAY);
+    uint32_t message_id = next_id++;
+    if(next_id == 0) next_id = 0x80000000;
+    reply_command = command;
+    reply_id = message_id;
+    reply_data = reply;
+    reply_capacity = capacity;
+    reply_size = 0;
+    memset(reply_status, 0, sizeof(reply_status));
+    reply_waiting = true;
+    xSemaphoreGive(reply_lock);
+
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, command, request_size, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes(request, request_size);
+    fsob_tx_unlock();
+
+    bool answered = xSemaphoreTake(reply_done, pdMS_TO_TICKS(HOSTFS_TIMEOUT)) == pdTRUE;
+    xSemaphoreTake(reply_lock, portMAX_DELAY);
+    if(!answered) answered = xSemaphoreTake(reply_done, 0) == pdTRUE;   //Answered right after the timeout
+    reply_waiting = false;
+    reply_data = NULL;
+    uint32_t size = reply_size;
+    int32_t status;
+    memcpy(&status, reply_status, HOSTFS_STATUS_SIZE);
+    xSemaphoreGive(reply_lock);
+
+    if(!answered) {
+        ESP_LOGW(TAG, "No answer from the host to %d", command);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if(size < HOSTFS_STATUS_SIZE) {     //Hosts without hostfs answer with a 3 byte ns status
+        errno = ENOSYS;
+        return -1;
+    }
+    if(status != 0) {
+        errno = status;
+        return -1;
+    }
+    return min(size - HOSTFS_STATUS_SIZE, capacity);
+}
+
+static hostfs_file_t *hostfs_file(int fd) {
+    if(fd < 0 || fd >= HOSTFS_FILES || !files[fd].in_use) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &files[fd];
+}
+
+static int hostfs_open(const char *path, int flags, int mode) {
+    if((flags & O_ACCMODE) != O_RDONLY) {
+        errno = EROFS;
+        return -1;
+    }
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    int fd = 0;
+    while(fd < HOSTFS_FILES && files[fd].in_use) fd++;
+    if(fd == HOSTFS_FILES) {
+        xSemaphoreGive(hostfs_mutex);
+        errno = ENFILE;
+        return -1;
+    }
+    uint32_t reply[3];  //Handle, size, mtime
+    int result = hostfs_call(HOSTOPEN, path, strlen(path)+1, reply, sizeof(reply));
+    if(result >= 0 && result < sizeof(reply)) {
+        errno = EIO;
+        result = -1;
+    }
+    if(result >= 0) {
+        files[fd] = (hostfs_file_t) {.in_use = true, .handle = reply[0], .size = reply[1], .mtime = reply[2], .pos = 0};
+        result = fd;
+    }
+    xSemaphoreGive(hostfs_mutex);
+    return result;
+}
+
+static ssize_t hostfs_read(int fd, void *dst, size_t size) {
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    hostfs_file_t *file = hostfs_file(fd);
+    if(file == NULL) {
+        xSemaphoreGive(hostfs_mutex);
+        return -1;
+    }
+    size_t done = 0;
+    while(done < size) {
+        uint32_t request[3] = {file->handle, file->pos, min(size - done, HOSTFS_READ_SIZE)};
+        int read = hostfs_call(HOSTREAD, request, sizeof(request), (uint8_t *) dst + done, request[2]);
+        if(read < 0) {
+            if(done > 0) break;     //Report what was read, the error shows up on the next read
+            xSemaphoreGive(hostfs_mutex);
+            return -1;
+        }
+        done += read;
+        file->pos += read;
+        if(read < request[2]) break;    //End of the file
+    }
+    xSemaphoreGive(hostfs_mutex);
+    return done;
+}
+
+static off_t hostfs_lseek(int fd, off_t offset, int whence) {
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    hostfs_file_t *file = hostfs_file(fd);
+    off_t result = -1;
+    if(file) {
+        off_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? file->pos : file->size;
+        if((whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) || base + offset < 0) {
+            errno = EINVAL;
+        } else {
+            file->pos = base + offset;
+            result = file->pos;
+        }
+    }
+    xSemaphoreGive(hostfs_mutex);
+    return result;
+}
+
+static int hostfs_fstat(int fd, struct stat *st) {
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    hostfs_file_t *file = hostfs_file(fd);
+    if(file) {
+        memset(st, 0, sizeof(*st));
+        st->st_mode = S_IFREG | 0444;
+        st->st_size = file->size;
+        st->st_mtime = file->mtime;
+    }
+    xSemaphoreGive(hostfs_mutex);
+    return file ? 0 : -1;
+}
+
+static int hostfs_stat(const char *path, struct stat *st) {
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    uint8_t reply[9];   //Size, mtime, type (d or f)
+    int result = hostfs_call(HOSTSTAT, path, strlen(path)+1, reply, sizeof(reply));
+    xSemaphoreGive(hostfs_mutex);
+    if(result >= 0 && result < sizeof(reply)) {
+        errno = EIO;
+        return -1;
+    }
+    if(result < 0) return -1;
+    uint32_t size, mtime;
+    memcpy(&size, &reply[0], 4);
+    memcpy(&mtime, &reply[4], 4);
+    memset(st, 0, sizeof(*st));
+    st->st_mode = reply[8] == 'd' ? (S_IFDIR | 0555) : (S_IFREG | 0444);
+    st->st_size = size;
+    st->st_mtime = mtime;
+    return 0;
+}
+
+static int hostfs_close(int fd) {
+    xSemaphoreTake(hostfs_mutex, portMAX_DELAY);
+    hostfs_file_t *file = hostfs_file(fd);
+    if(file) {
+        hostfs_call(HOSTCLOSE, &file->handle, 4, NULL, 0);     //The file is closed on the badge whatever the host answers
+        file->in_use = false;
+    }
+    xSemaphoreGive(hostfs_mutex);
+    return file ? 0 : -1;
+}
+
+esp_err_t fsob_hostfs_init(void) {
+    hostfs_mutex = xSemaphoreCreateMutex();
+    reply_done = xSemaphoreCreateBinary();
+    reply_lock = xSemaphoreCreateMutex();
+    if(hostfs_mutex == NULL || reply_done == NULL || reply_lock == NULL) {
+        reply_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    esp_vfs_t vfs = {
+        .flags = ESP_VFS_FLAG_DEFAULT,
+        .open = hostfs_open,
+        .read = hostfs_read,
+        .lseek = hostfs_lseek,
+        .fstat = hostfs_fstat,
+        .stat = hostfs_stat,
+        .close = hostfs_close,
+    };
+    return esp_vfs_register(HOSTFS_MOUNT, &vfs, NULL);
+}
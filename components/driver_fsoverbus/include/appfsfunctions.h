@@ -1,9 +1,40 @@
 #ifndef __APPFSFUNCTIONS_H__
 #define __APPFSFUNCTIONS_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "esp_spi_flash.h"
+
+/**
+ * @brief Redefine the appfs functions used. This allows to compile the component when appfs support is disabled.
+ * 
+ */
+#define APPFS_INVALID_FD (-1)
+typedef int appfs_handle_t;
+void appfsEntryInfo(appfs_handle_t fd, const char **name, int *size);
+appfs_handle_t appfsNextEntry(appfs_handle_t fd);
+esp_err_t appfsDeleteFile(const char *filename);
+esp_err_t appfsCreateFile(const char *filename, size_t size, appfs_handle_t *handle);
+esp_err_t appfsErase(appfs_handle_t fd, size_t start, size_t len);
+esp_err_t appfsWrite(appfs_handle_t fd, size_t start, uint8_t *buf, size_t len);
+appfs_handle_t appfsOpen(const char *filename);
+esp_err_t appfsRead(appfs_handle_t fd, size_t start, void *buf, size_t len);
+esp_err_t appfsMmap(appfs_handle_t fd, size_t offset, size_t len, const void** out_ptr, spi_flash_mmap_memory_t memory, spi_flash_mmap_handle_t* out_handle);
+void appfsMunmap(spi_flash_mmap_handle_t handle);
+
+#define APPFS_HASH_SIZE (32)
+
+bool appfs_hash(appfs_handle_t fd, uint32_t size, uint8_t *hash);
+void appfs_boot(appfs_handle_t fd);
+
 int appfslist(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 int appfsdel(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 int appfswrite(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int appfswritepart(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int appfsread(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int appfsdeploy(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 int appfsboot(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 
 #endif
\ No newline at end of file
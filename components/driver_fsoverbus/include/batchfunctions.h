@@ -0,0 +1,17 @@
+#ifndef BATCH_FUNCTIONS_H
+#define BATCH_FUNCTIONS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+//Result codes of the commands in a batch
+enum BATCHRESULTS {
+    BATCH_OK = 0,
+    BATCH_ERROR,
+    BATCH_NOTSUPPORTED,
+    BATCH_SKIPPED
+};
+
+int batch(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BAUDRATE_H
+#define BAUDRATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/***
+ * Link speed negotiation.
+ * The host asks for a new baud rate with setbaud. The badge confirms at the current rate and switches, the host then switches as well
+ * and has to send a heartbeat at the new rate. When that heartbeat does not arrive the badge goes back to the last rate that worked.
+ * All of this runs in the fsob task, the backend polls for the timeout while it waits for packets.
+ ***/
+
+#define BAUD_MIN             (9600)
+#define BAUD_MAX             (5000000)
+#define BAUD_CONFIRM_TIMEOUT (2000)    //Time in ms the host has to send a heartbeat at the new rate
+
+//Switch the bus to baud after everything queued has been sent. Returns false when the rate can not be used.
+typedef bool (*fsob_baud_set_t)(uint32_t baud);
+
+void fsob_baud_attach(fsob_baud_set_t set, uint32_t baud);
+void fsob_baud_confirm(void);
+void fsob_baud_poll(void);          //Backends with a baud rate call this regularly from the fsob task
+uint32_t fsob_baud_current(void);   //0 when the backend has no baud rate
+
+int setbaud(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***
+ * Channels multiplexed on the bus.
+ * Enabled by the host with the channelmode special function. Afterwards everything on the bus, in both directions, is sent in frames
+ * of at most CONFIG_DRIVER_FSOVERBUS_CHANNEL_FRAME_SIZE bytes, each tagged with a channel. The file channel carries the normal packets,
+ * the console channel carries console output (and log output) to the host and stdin from the host.
+ * Frames of the channels are sent in turn, so console output gets out while a large reply is streamed.
+ ***/
+
+#define CHANNEL_HEADER_SIZE   (4)     //Channel, channel xor 0xFF, 2 byte length
+#define CHANNEL_FILE          (0)
+#define CHANNEL_CONSOLE       (1)
+
+//Read up to length bytes from the bus, waiting at most timeout_ms. Returns the amount of bytes read, -1 when the bus is closed.
+typedef int (*fsob_channels_read_t)(uint8_t *buffer, uint32_t length, uint32_t timeout_ms);
+//Write all bytes to the bus
+typedef void (*fsob_channels_write_t)(const uint8_t *src, uint32_t length);
+
+void fsob_channels_init(void);
+void fsob_channels_attach(fsob_channels_read_t read, fsob_channels_write_t write);
+bool fsob_channels_enabled(void);
+int fsob_channels_read(uint8_t *buffer, uint32_t length, uint32_t timeout_ms);
+void fsob_channels_write(const uint8_t *src, uint32_t length);
+
+//Console channel, for the firmware
+size_t fsob_console_write(const char *data, size_t length);
+int fsob_console_read(uint8_t *buffer, size_t length, uint32_t timeout_ms);
+void fsob_console_input(const uint8_t *data, size_t length);
+void fsob_console_attach_reader(bool attached);     //Console input is dropped while no reader is attached
+bool fsob_console_has_reader(void);
+
+int channelmode(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
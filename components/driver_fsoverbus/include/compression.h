@@ -0,0 +1,41 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "writer.h"
+
+/***
+ * Compressed transfers.
+ * A compressed stream is a sequence of blocks. Every block starts with a 4 byte compressed length and a 4 byte raw length,
+ * followed by the block data in LZ4 block format. When bit 31 of the compressed length is set the block is stored uncompressed.
+ * A block never holds more than LZ_BLOCK_SIZE bytes of raw data.
+ ***/
+
+#define LZ_BLOCK_SIZE        (4096)
+#define LZ_BLOCK_HEADER_SIZE (8)
+#define LZ_BLOCK_STORED      (0x80000000)
+#define LZ_BLOCK_BOUND       (LZ_BLOCK_SIZE + LZ_BLOCK_SIZE/255 + 16)
+
+typedef struct {
+    uint8_t header[LZ_BLOCK_HEADER_SIZE];
+    uint32_t header_fill;
+    uint32_t compressed_length;
+    uint32_t raw_length;
+    uint32_t block_fill;
+    uint8_t block[LZ_BLOCK_BOUND];
+    uint8_t raw[LZ_BLOCK_SIZE];
+} fsob_lz_stream_t;
+
+int lz_compress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity, uint16_t *table);
+int lz_decompress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity);
+
+uint32_t lz_compressfile(FILE *fptr, uint32_t length, uint8_t *out, uint32_t capacity);
+
+fsob_lz_stream_t *lz_stream_create(void);
+bool lz_stream_write(fsob_lz_stream_t *stream, fsob_write_ctx_t *ctx, const uint8_t *data, uint32_t length);
+bool lz_stream_complete(fsob_lz_stream_t *stream);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CRCMODE_H
+#define CRCMODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/***
+ * Checksummed transport with selective retransmission.
+ * Enabled by the host with the crcmode special function. Afterwards every packet header is followed by its CRC32 and the payload is sent
+ * in numbered frames of CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE bytes, each with a header checksum and a CRC32 of its data.
+ * A corrupt or missing frame is answered with a NAK carrying its sequence number, and only that frame is sent again.
+ * Frames that arrive after a missing one are kept in a reorder buffer, so the handlers still see the payload in order.
+ * Garbage between packets is skipped byte by byte until the next valid header instead of flushing the receive buffer.
+ ***/
+
+#define CRC_HEADER_SIZE   (12 + 4)     //Packet header followed by its CRC32
+#define CRC_FRAME_SIZE    (12)         //Message id, sequence number, length, header check
+#define CRC_NAK_HEADER    (0xFFFFFFFF) //NAK sequence number asking for the packet header and all of its frames
+
+//Read up to length bytes from the bus, waiting at most timeout_ms. Returns the amount of bytes read.
+typedef int (*fsob_crc_read_t)(uint8_t *buffer, uint32_t length, uint32_t timeout_ms);
+
+void fsob_crc_attach(fsob_crc_read_t read);
+bool fsob_crc_enabled(void);
+void fsob_crc_receive(uint8_t *buffer);
+
+int crcmode(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
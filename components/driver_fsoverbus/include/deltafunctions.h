@@ -0,0 +1,11 @@
+#ifndef DELTA_FUNCTIONS_H
+#define DELTA_FUNCTIONS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+int fileblockhash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int filehash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int writedelta(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
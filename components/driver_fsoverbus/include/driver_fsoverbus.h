@@ -6,6 +6,7 @@
 
 esp_err_t driver_fsoverbus_init(void);
 
+int dispatchFSCommand(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 void handleFSCommand(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
 void fsob_start_timeout();
 void fsob_stop_timeout();
@@ -0,0 +1,21 @@
+#ifndef FLOWCONTROL_H
+#define FLOWCONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/***
+ * Credit based flow control.
+ * The host enables it with the flowcontrol special function, the reply carries the size of the receive buffer as initial credits.
+ * Every byte sent by the host uses one credit. The backend reports every byte it takes out of its receive buffer,
+ * these are returned to the host in credit packets once CONFIG_DRIVER_FSOVERBUS_CREDIT_GRANT bytes have been consumed.
+ * A host that never sends more than its credits can't overflow the receive buffer, no hardware flow control is needed.
+ ***/
+
+void fsob_flow_set_window(uint32_t window);
+void fsob_flow_consumed(uint32_t bytes);
+bool fsob_flow_enabled(void);
+
+int flowcontrol(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
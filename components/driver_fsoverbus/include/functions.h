@@ -5,11 +5,25 @@
 #define FILEFUNCTIONSBASE    (4096)
 #define BADGEFUNCTIONSBASE   (8192)
 
+#define COMPRESSEDFLAG       (0x8000)   //Set on readfile, writefile and appfswrite to use a compressed payload
+
+#define PARTFINAL            (0x01)     //Flag of writepart and appfswritepart, the part completes the file
+#define BATCHSTOPONERROR     (0x01)     //Flag of batch, skip the remaining commands after a failed one
+#define PARTSKIPERASED       (0x01)     //Flag of partread, leave out erased sectors
+#define DEPLOYSKIPSAME       (0x01)     //Flag of appfsdeploy, boot the installed app without writing when its hash matches
+
 enum SPECIALFUNCTIONS {
     EXECFILE = 0,
     HEARTBEAT,
     PYTHONSTDIN,
     APPFSBOOT,
+    FLOWCONTROL,
+    GETSTATS,
+    RESETSTATS,
+    CRCMODE,
+    CRCNAK,
+    CHANNELMODE,
+    SETBAUD,
     SPECIALFUNCTIONSLEN
 };
 
@@ -24,6 +38,26 @@ enum FILEFUNCTIONS {
     APPFSDIR,
     APPFSDEL,
     APPFSWRITE,
+    GETDIREX,
+    FILEBLOCKHASH,
+    WRITEDELTA,
+    READRANGE,
+    WRITEPART,
+    APPFSWRITEPART,
+    WRITEOFFSET,
+    FILEHASH,
+    BATCH,
+    PARTBLOCKHASH,
+    PARTREAD,
+    TAREXPORT,
+    TARIMPORT,
+    APPFSREAD,
+    APPFSDEPLOY,
+    HOSTOPEN,       //Sent by the badge, answered by the host
+    HOSTREAD,
+    HOSTSTAT,
+    HOSTCLOSE,
+    WATCH,
     FILEFUNCTIONSLEN
 };
 
@@ -0,0 +1,22 @@
+#ifndef HOSTFS_H
+#define HOSTFS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+/***
+ * Files served by the host.
+ * Mounts HOSTFS_MOUNT as a read only VFS. Opening, reading and stating a file there sends a hostopen, hostread, hoststat or hostclose
+ * packet to the host and waits for the host to answer it, so the firmware can use assets on the developer's PC without copying them first.
+ * Only one call is on the bus at a time. Never use these files from the bus task itself, it is the task that receives the answers.
+ ***/
+
+#define HOSTFS_MOUNT     "/host"
+#define HOSTFS_READ_SIZE (16384)    //Largest read asked from the host at once, keeps the bus free for other packets
+
+esp_err_t fsob_hostfs_init(void);
+
+//Handles the answers of the host, registered for hostopen, hostread, hoststat and hostclose
+int hostreply(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -2,17 +2,25 @@
 #define PACKETUTILS_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define RD_BUF_SIZE 512
 
 #define PACKET_HEADER_SIZE 12
 
+void fsob_tx_init(void);
+void fsob_tx_lock(void);
+void fsob_tx_unlock(void);
 void createMessageHeader(uint8_t *header, uint16_t command, uint32_t size, uint32_t message_id);
+void fsob_write_header(const uint8_t *header);
 void sendok(uint16_t command, uint32_t message_id);
 void sender(uint16_t command, uint32_t message_id);
 void sendte(uint16_t command, uint32_t message_id);
 void sendto(uint16_t command, uint32_t message_id);
 void sendns(uint16_t command, uint32_t message_id);
+void fsob_status_capture(uint32_t message_id);
+void fsob_status_capture_end(char *status);
 void buildfile(char *source, char *target);
+uint32_t streamfile(FILE *fptr, uint32_t length);
 
 #endif
\ No newline at end of file
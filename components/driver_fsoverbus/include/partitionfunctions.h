@@ -0,0 +1,10 @@
+#ifndef PARTITION_FUNCTIONS_H
+#define PARTITION_FUNCTIONS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+int partblockhash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int partread(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef REQUESTS_H
+#define REQUESTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "writer.h"
+#include "compression.h"
+
+/***
+ * Table of requests that are still in flight, keyed by message id.
+ * A request is opened when a transfer starts and closed once its reply has been sent. This replaces per function static state,
+ * so a host can keep several requests outstanding and only commands touching the same path wait for each other.
+ ***/
+
+typedef struct {
+    bool in_use;
+    bool receiving;         //Payload is still arriving on the bus
+    bool appfs;
+    bool failed;            //Request could not be started, reply with an error once all payload arrived
+    bool skip;              //Nothing to store, the payload is dropped and the request succeeds
+    uint16_t command;
+    uint32_t message_id;
+    char path[256];         //Target of the request, used to order conflicting commands
+    fsob_write_ctx_t *write_ctx;
+    fsob_lz_stream_t *lz;   //Set when the payload is compressed
+
+    //Delta write state
+    uint32_t block_size;
+    uint32_t literal;       //Bytes of the current data instruction still to come
+    uint8_t op[9];          //Instruction being received
+    uint8_t op_fill;
+
+    //Batch payload, executed once complete
+    uint8_t *batch;
+    uint32_t batch_fill;
+
+    //Archive being unpacked
+    struct fsob_tar *tar;
+} fsob_request_t;
+
+void fsob_requests_init(void);
+
+fsob_request_t *fsob_request_open(uint16_t command, uint32_t message_id);
+fsob_request_t *fsob_request_find(uint32_t message_id);
+void fsob_request_received(fsob_request_t *req);
+void fsob_request_write(fsob_request_t *req, const uint8_t *data, uint32_t length);
+void fsob_request_finish(fsob_request_t *req);
+void fsob_request_close(uint32_t message_id);
+bool fsob_request_pending(uint32_t message_id);
+void fsob_request_abort_receiving(void);
+void fsob_request_order(uint16_t command, uint8_t *data, uint32_t size);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/***
+ * Per command statistics.
+ * Every packet is timed from its first payload chunk on. Receive time lasts until the last chunk arrived, handler time is spent in
+ * the command function and flash time in the writer task. Time to first byte and total time end at the first reply header and once
+ * the request is complete. Both are kept as histograms with power of two buckets.
+ ***/
+
+#define STATS_BUCKETS      (16)
+#define STATS_BUCKET_SHIFT (7)     //First bucket holds everything below 2^7 us, the last one everything above 2^21 us
+
+void fsob_stats_init(void);
+void fsob_stats_begin(uint16_t command, uint32_t message_id, uint32_t size);
+void fsob_stats_received(uint32_t message_id);
+void fsob_stats_handler(uint32_t message_id, int64_t us);
+void fsob_stats_flash(uint32_t message_id, int64_t us);
+void fsob_stats_reply(uint32_t message_id, uint32_t size);
+void fsob_stats_end(uint32_t message_id);
+
+int getstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int resetstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TAR_FUNCTIONS_H
+#define TAR_FUNCTIONS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+int tarexport(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+int tarimport(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/***
+ * Asynchronous flash writer.
+ * Incoming payload is copied into a pool of fixed-size buffers which are written to FAT or AppFS by a separate task.
+ * This keeps the bus task draining the bus while the flash is being erased or programmed.
+ * Requests are executed in order. The ok/er reply of a transfer is sent by the writer task once all data is stored.
+ ***/
+
+typedef struct fsob_write_ctx fsob_write_ctx_t;
+
+void fsob_writer_init(void);
+
+fsob_write_ctx_t *fsob_writer_open_file(const char *path);
+fsob_write_ctx_t *fsob_writer_open_appfs(const char *name, uint32_t size);
+fsob_write_ctx_t *fsob_writer_open_file_part(const char *path, uint32_t offset, bool final);
+fsob_write_ctx_t *fsob_writer_open_appfs_part(const char *name, uint32_t size, uint32_t offset, bool final);
+uint32_t fsob_writer_resume_offset(const char *path, bool appfs);
+void fsob_writer_write(fsob_write_ctx_t *ctx, const uint8_t *data, uint32_t length);
+void fsob_writer_copy(fsob_write_ctx_t *ctx, uint32_t offset, uint32_t length);
+void fsob_writer_commit(fsob_write_ctx_t *ctx, uint16_t command, uint32_t message_id);
+void fsob_writer_close(fsob_write_ctx_t *ctx, uint32_t message_id);
+void fsob_writer_reply(uint16_t command, uint32_t message_id, bool failed);
+void fsob_writer_set_mtime(fsob_write_ctx_t *ctx, uint32_t mtime);
+void fsob_writer_set_deploy(fsob_write_ctx_t *ctx, const uint8_t *hash);
+void fsob_writer_abort(fsob_write_ctx_t *ctx);
+void fsob_writer_sync(void);
+
+#endif
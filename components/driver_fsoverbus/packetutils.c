@@ -1,10 +1,36 @@
 #include "include/packetutils.h"
 #include "include/fsob_backend.h"
+#include "include/stats.h"
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <esp_log.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 #define TAG "fsoveruart_pu"
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+static SemaphoreHandle_t tx_mutex = NULL;
+
+void fsob_tx_init(void) {
+    if(tx_mutex == NULL) tx_mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+/*
+* Replies can be sent from more than one task. Hold the lock while writing a reply that consists of multiple fsob_write_bytes calls,
+* so replies never get interleaved on the bus.
+*/
+void fsob_tx_lock(void) {
+    if(tx_mutex) xSemaphoreTakeRecursive(tx_mutex, portMAX_DELAY);
+}
+
+void fsob_tx_unlock(void) {
+    if(tx_mutex) xSemaphoreGiveRecursive(tx_mutex);
+}
+
 void createMessageHeader(uint8_t *header, uint16_t command, uint32_t size, uint32_t messageid) {
     uint16_t *com = (uint16_t *) header;
     *com = command;
@@ -16,44 +42,76 @@ void createMessageHeader(uint8_t *header, uint16_t command, uint32_t size, uint3
     *id = messageid;
 }
 
+//Write a header built by createMessageHeader. The reply is counted for its request here, once it actually goes out.
+void fsob_write_header(const uint8_t *header) {
+    uint32_t size, message_id;
+    memcpy(&size, &header[2], 4);
+    memcpy(&message_id, &header[8], 4);
+    fsob_write_bytes((const char*) header, PACKET_HEADER_SIZE);
+    fsob_stats_reply(message_id, size);
+}
+
+static bool capture_active = false;
+static uint32_t capture_id;
+static char capture_status[3];
+
+/*
+* Store the status reply for message_id instead of sending it. Used to collect the results of batched commands,
+* which can be replied from the writer task.
+*/
+void fsob_status_capture(uint32_t message_id) {
+    fsob_tx_lock();
+    capture_active = true;
+    capture_id = message_id;
+    capture_status[0] = 0;
+    fsob_tx_unlock();
+}
+
+//Stop capturing and copy the captured status into status, empty when none was sent
+void fsob_status_capture_end(char *status) {
+    fsob_tx_lock();
+    capture_active = false;
+    strcpy(status, capture_status);
+    fsob_tx_unlock();
+}
+
+static void sendstatus(uint16_t command, uint32_t message_id, const char *status) {
+    uint8_t header[PACKET_HEADER_SIZE+3];
+    createMessageHeader(header, command, 3, message_id);
+    strcpy((char *) &header[PACKET_HEADER_SIZE], status);
+    fsob_tx_lock();
+    if(capture_active && message_id == capture_id) {
+        strcpy(capture_status, status);
+    } else {
+        fsob_write_bytes((const char*) header, PACKET_HEADER_SIZE+3);
+        fsob_stats_reply(message_id, 3);
+    }
+    fsob_tx_unlock();
+}
+
 //Error executing function
 void sender(uint16_t command, uint32_t message_id) {
-     uint8_t header[PACKET_HEADER_SIZE+3];
-    createMessageHeader(header, command, 3, message_id);
-    strcpy((char *) &header[PACKET_HEADER_SIZE], "er");
-    fsob_write_bytes((const char*) header, 15);
+    sendstatus(command, message_id, "er");
 }
 
 //Okay
 void sendok(uint16_t command, uint32_t message_id) {
-     uint8_t header[PACKET_HEADER_SIZE+3];
-    createMessageHeader(header, command, 3, message_id);
-    strcpy((char *) &header[PACKET_HEADER_SIZE], "ok");
-    fsob_write_bytes((const char*) header, 15);
+    sendstatus(command, message_id, "ok");
 }
 
 //Transmission error
 void sendte(uint16_t command, uint32_t message_id) {
-     uint8_t header[PACKET_HEADER_SIZE+3];
-    createMessageHeader(header, command, 3, message_id);
-    strcpy((char *) &header[PACKET_HEADER_SIZE], "te");
-    fsob_write_bytes((const char*) header, 15);
+    sendstatus(command, message_id, "te");
 }
 
 //Timeout error
 void sendto(uint16_t command, uint32_t message_id) {
-    uint8_t header[PACKET_HEADER_SIZE+3];
-    createMessageHeader(header, command, 3, message_id);
-    strcpy((char *) &header[PACKET_HEADER_SIZE], "to");
-    fsob_write_bytes((const char*) header, 15);
+    sendstatus(command, message_id, "to");
 }
 
 //Not supported error
 void sendns(uint16_t command, uint32_t message_id) {
-    uint8_t header[PACKET_HEADER_SIZE+3];
-    createMessageHeader(header, command, 3, message_id);
-    strcpy((char *) &header[PACKET_HEADER_SIZE], "ns");
-    fsob_write_bytes((const char*) header, 15);
+    sendstatus(command, message_id, "ns");
 }
 
 void buildfile(char *source, char *target) {
@@ -64,4 +122,39 @@ void buildfile(char *source, char *target) {
         strcpy(target, "/sd");
         strcat(target, &source[7]);
     }
+}
+
+/*
+* Send length bytes of fptr, starting at the current position, to the bus.
+* The data is read in CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE chunks. Flow control is left to fsob_write_bytes,
+* which blocks until the backend can accept more data.
+* When the file ends early the remainder is padded with zeros so the packet length announced in the header is kept.
+* Returns the amount of bytes actually read from the file.
+*/
+uint32_t streamfile(FILE *fptr, uint32_t length) {
+    uint8_t fallback[128];
+    uint8_t *buffer = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    uint32_t buffer_size = CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE;
+    if(buffer == NULL) {
+        ESP_LOGW(TAG, "Failed to allocate transfer buffer, using small buffer");
+        buffer = fallback;
+        buffer_size = sizeof(fallback);
+    }
+
+    uint32_t sent = 0;
+    uint32_t read_total = 0;
+    while(sent < length) {
+        uint32_t chunk = min(buffer_size, length-sent);
+        uint32_t read_bytes = fptr ? fread(buffer, 1, chunk, fptr) : 0;
+        read_total += read_bytes;
+        if(read_bytes < chunk) {
+            memset(&buffer[read_bytes], 0, chunk-read_bytes);
+            fptr = NULL;    //Stop reading after a short read, only padding follows
+        }
+        fsob_write_bytes((const char*) buffer, chunk);
+        sent += chunk;
+    }
+
+    if(buffer != fallback) free(buffer);
+    return read_total;
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include "mbedtls/sha256.h"
+#include "esp_spi_flash.h"
+
+#include "include/fsob_backend.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+#include "include/partitionfunctions.h"
+
+#define TAG "fsoveruart_part"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define PART_HASH_SIZE  (16)    //Truncated SHA-256, like fileblockhash
+#define PART_ENTRY_SIZE (1+PART_HASH_SIZE)
+
+/***
+ * Raw partition access for imaging a badge.
+ * Only the partitions listed in CONFIG_DRIVER_FSOVERBUS_PARTITION_LABELS can be read. partblockhash lets the host find the blocks
+ * that changed since an earlier image, partread streams a range of the partition and can leave out erased sectors.
+ * Every request touching the filesystems has completed before these run, so the image is consistent.
+ ***/
+
+static const esp_partition_t *part_find(const char *label) {
+    size_t length = strlen(label);
+    const char *allowed = CONFIG_DRIVER_FSOVERBUS_PARTITION_LABELS;
+    while(*allowed) {
+        while(*allowed == ' ' || *allowed == ',') allowed++;
+        size_t token = strcspn(allowed, " ,");
+        if(token > 0 && token == length && strncmp(allowed, label, length) == 0) {
+            return esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, label);
+        }
+        allowed += token;
+    }
+    ESP_LOGI(TAG, "Partition %s can not be accessed", label);
+    return NULL;
+}
+
+static bool part_erased(const uint8_t *data, uint32_t length) {
+    for(uint32_t i = 0; i < length; i++) {
+        if(data[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+/***
+ * Datafield: partition label, 0 terminated, followed by the 4 byte block size (a multiple of 4096, 0 for 4096).
+ * Response: 4 byte partition size, 4 byte block size, 4 byte amount of blocks. Then for every block a byte that is 0 when the block
+ * is erased and 1 when it holds data, followed by the first 16 bytes of the SHA-256 of the block (zeros for erased blocks).
+ ***/
+int partblockhash(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint32_t name_length = strnlen((char *) data, size);
+    uint32_t block_size = 0;
+    if(size >= name_length+1+4) {
+        memcpy(&block_size, &data[name_length+1], 4);
+    }
+    if(block_size == 0) block_size = SPI_FLASH_SEC_SIZE;
+    const esp_partition_t *partition = name_length < size ? part_find((char *) data) : NULL;
+    uint8_t *buffer = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    if(partition == NULL || buffer == NULL || block_size % SPI_FLASH_SEC_SIZE != 0) {
+        free(buffer);
+        sender(command, message_id);
+        return 1;
+    }
+
+    uint32_t partition_size = partition->size;
+    uint32_t blocks = (partition_size + block_size - 1) / block_size;
+    uint8_t header[12];
+    createMessageHeader(header, command, 12 + blocks*PART_ENTRY_SIZE, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &partition_size, 4);
+    fsob_write_bytes((const char*) &block_size, 4);
+    fsob_write_bytes((const char*) &blocks, 4);
+
+    mbedtls_sha256_context sha;
+    for(uint32_t i = 0; i < blocks; i++) {
+        uint32_t offset = i * block_size;
+        uint32_t remaining = min(block_size, partition_size - offset);
+        bool erased = true;
+        uint8_t entry[1+32];
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts_ret(&sha, 0);
+        while(remaining > 0) {
+            uint32_t chunk = min(remaining, CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+            if(esp_partition_read(partition, offset, buffer, chunk) != ESP_OK) {
+                memset(buffer, 0, chunk);   //Reported as data that never matches, the reply length is already sent
+            }
+            erased = erased && part_erased(buffer, chunk);
+            mbedtls_sha256_update_ret(&sha, buffer, chunk);
+            offset += chunk;
+            remaining -= chunk;
+        }
+        mbedtls_sha256_finish_ret(&sha, &entry[1]);
+        mbedtls_sha256_free(&sha);
+        entry[0] = erased ? 0 : 1;
+        if(erased) memset(&entry[1], 0, PART_HASH_SIZE);
+        fsob_write_bytes((const char*) entry, PART_ENTRY_SIZE);
+    }
+    fsob_tx_unlock();
+    free(buffer);
+    return 1;
+}
+
+/***
+ * Datafield: partition label, 0 terminated, 4 byte offset, 4 byte length (0 reads up to the end) and an optional flags byte.
+ * Response: 4 byte partition size followed by the requested bytes.
+ * With flag 0x01 (PARTSKIPERASED) offset and length have to be multiples of 4096. Every sector is then sent as a byte that is 0
+ * for an erased sector, which is not sent, or 1 followed by the 4096 bytes of the sector.
+ ***/
+int partread(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint32_t name_length = strnlen((char *) data, size);
+    uint32_t offset, range;
+    uint8_t flags = 0;
+    if(size < name_length+1+8) {
+        sender(command, message_id);
+        return 1;
+    }
+    memcpy(&offset, &data[name_length+1], 4);
+    memcpy(&range, &data[name_length+1+4], 4);
+    if(size > name_length+1+8) flags = data[name_length+1+8];
+
+    const esp_partition_t *partition = part_find((char *) data);
+    if(partition == NULL) {
+        sender(command, message_id);
+        return 1;
+    }
+    uint32_t partition_size = partition->size;
+    if(offset > partition_size) offset = partition_size;
+    if(range == 0 || range > partition_size-offset) range = partition_size-offset;
+
+    bool skip = flags & PARTSKIPERASED;
+    uint32_t sectors = range / SPI_FLASH_SEC_SIZE;
+    uint8_t *buffer = malloc(skip ? SPI_FLASH_SEC_SIZE : CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    uint8_t *erased = skip ? calloc((sectors + 7) / 8, 1) : NULL;
+    if(buffer == NULL || (skip && (erased == NULL || offset % SPI_FLASH_SEC_SIZE != 0 || range % SPI_FLASH_SEC_SIZE != 0))) {
+        free(buffer);
+        free(erased);
+        sender(command, message_id);
+        return 1;
+    }
+
+    //The reply length is needed up front, so the erased sectors are found before sending. Reading flash is far faster than the bus.
+    uint32_t reply_size = 4 + range;
+    if(skip) {
+        reply_size = 4 + sectors;
+        for(uint32_t i = 0; i < sectors; i++) {
+            if(esp_partition_read(partition, offset + i*SPI_FLASH_SEC_SIZE, buffer, SPI_FLASH_SEC_SIZE) == ESP_OK && part_erased(buffer, SPI_FLASH_SEC_SIZE)) {
+                erased[i/8] |= 1 << (i%8);
+            } else {
+                reply_size += SPI_FLASH_SEC_SIZE;
+            }
+        }
+    }
+
+    uint8_t header[12];
+    createMessageHeader(header, command, reply_size, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) &partition_size, 4);
+    if(skip) {
+        for(uint32_t i = 0; i < sectors; i++) {
+            uint8_t marker = (erased[i/8] & (1 << (i%8))) ? 0 : 1;
+            fsob_write_bytes((const char*) &marker, 1);
+            if(marker == 0) continue;
+            if(esp_partition_read(partition, offset + i*SPI_FLASH_SEC_SIZE, buffer, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+                memset(buffer, 0, SPI_FLASH_SEC_SIZE);
+            }
+            fsob_write_bytes((const char*) buffer, SPI_FLASH_SEC_SIZE);
+        }
+    } else {
+        while(range > 0) {
+            uint32_t chunk = min(range, CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+            if(esp_partition_read(partition, offset, buffer, chunk) != ESP_OK) {
+                memset(buffer, 0, chunk);
+            }
+            fsob_write_bytes((const char*) buffer, chunk);
+            offset += chunk;
+            range -= chunk;
+        }
+    }
+    fsob_tx_unlock();
+    free(buffer);
+    free(erased);
+    return 1;
+}
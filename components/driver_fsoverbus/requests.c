@@ -0,0 +1,261 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "include/requests.h"
+#include "include/packetutils.h"
+#include "include/functions.h"
+#include "include/stats.h"
+
+#define TAG "fsob_req"
+
+static fsob_request_t requests[CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS];
+static SemaphoreHandle_t requests_mutex = NULL;
+static SemaphoreHandle_t requests_changed = NULL;  //Given every time a request is closed
+
+void fsob_requests_init(void) {
+    requests_mutex = xSemaphoreCreateMutex();
+    requests_changed = xSemaphoreCreateBinary();
+    memset(requests, 0, sizeof(requests));
+}
+
+static void requests_lock(void) {
+    xSemaphoreTake(requests_mutex, portMAX_DELAY);
+}
+
+static void requests_unlock(void) {
+    xSemaphoreGive(requests_mutex);
+}
+
+/*
+* Claim a free slot for message_id. Blocks until a slot is released when the table is full.
+*/
+fsob_request_t *fsob_request_open(uint16_t command, uint32_t message_id) {
+    for(;;) {
+        requests_lock();
+        for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS; i++) {
+            if(!requests[i].in_use) {
+                memset(&requests[i], 0, sizeof(fsob_request_t));
+                requests[i].in_use = true;
+                requests[i].receiving = true;
+                requests[i].command = command;
+                requests[i].message_id = message_id;
+                requests_unlock();
+                return &requests[i];
+            }
+        }
+        requests_unlock();
+        ESP_LOGD(TAG, "Request table full, waiting");
+        xSemaphoreTake(requests_changed, pdMS_TO_TICKS(100));
+    }
+}
+
+fsob_request_t *fsob_request_find(uint32_t message_id) {
+    fsob_request_t *req = NULL;
+    requests_lock();
+    for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS; i++) {
+        if(requests[i].in_use && requests[i].receiving && requests[i].message_id == message_id) {
+            req = &requests[i];
+            break;
+        }
+    }
+    requests_unlock();
+    return req;
+}
+
+/*
+* All payload of the request has arrived. The request stays in the table until its reply is sent.
+*/
+void fsob_request_received(fsob_request_t *req) {
+    requests_lock();
+    req->receiving = false;
+    req->write_ctx = NULL;  //Owned by the writer task from now on
+    free(req->lz);
+    req->lz = NULL;
+    requests_unlock();
+}
+
+static void request_fail(fsob_request_t *req) {
+    if(req->write_ctx) fsob_writer_abort(req->write_ctx);
+    req->write_ctx = NULL;
+    req->failed = true;
+}
+
+/*
+* Pass payload of a write request on to the writer, decompressing it first when the request is compressed.
+*/
+void fsob_request_write(fsob_request_t *req, const uint8_t *data, uint32_t length) {
+    if(req->write_ctx == NULL) return;
+    if(req->lz == NULL) {
+        fsob_writer_write(req->write_ctx, data, length);
+    } else if(!lz_stream_write(req->lz, req->write_ctx, data, length)) {
+        ESP_LOGI(TAG, "Corrupt compressed data in request %d", req->message_id);
+        request_fail(req);
+    }
+}
+
+/*
+* All payload of a write request has arrived. Hands the file to the writer task, which replies and closes the request
+* once it is stored, or replies with an error straight away when the request failed.
+*/
+void fsob_request_finish(fsob_request_t *req) {
+    if(req->lz && !lz_stream_complete(req->lz)) {
+        request_fail(req);
+    }
+    fsob_write_ctx_t *ctx = req->write_ctx;
+    uint16_t command = req->command;
+    uint32_t message_id = req->message_id;
+    fsob_request_received(req);
+    if(ctx) {
+        fsob_writer_commit(ctx, command, message_id);
+    } else {
+        sender(command, message_id);
+        fsob_request_close(message_id);
+    }
+}
+
+void fsob_request_close(uint32_t message_id) {
+    requests_lock();
+    for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS; i++) {
+        if(requests[i].in_use && !requests[i].receiving && requests[i].message_id == message_id) {
+            requests[i].in_use = false;
+            break;
+        }
+    }
+    requests_unlock();
+    xSemaphoreGive(requests_changed);
+    fsob_stats_end(message_id);
+}
+
+//True while message_id occupies a slot in the table
+bool fsob_request_pending(uint32_t message_id) {
+    bool pending = false;
+    requests_lock();
+    for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS; i++) {
+        if(requests[i].in_use && requests[i].message_id == message_id) {
+            pending = true;
+            break;
+        }
+    }
+    requests_unlock();
+    return pending;
+}
+
+/*
+* Packets arrive back to back on the bus. When a new packet starts, a request still receiving payload was cut off and is aborted.
+*/
+void fsob_request_abort_receiving(void) {
+    fsob_write_ctx_t *aborted[CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS];
+    int amount = 0;
+
+    requests_lock();
+    for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS; i++) {
+        if(requests[i].in_use && requests[i].receiving) {
+            ESP_LOGI(TAG, "Aborting incomplete request %d", requests[i].message_id);
+            if(requests[i].write_ctx) aborted[amount++] = requests[i].write_ctx;
+            free(requests[i].lz);
+            requests[i].lz = NULL;
+            free(requests[i].batch);
+            requests[i].batch = NULL;
+            free(requests[i].tar);
+            requests[i].tar = NULL;
+            requests[i].in_use = false;
+        }
+    }
+    requests_unlock();
+
+    //Queued outside of the lock, the writer task needs the table to close requests
+    for(int i = 0; i < amount; i++) {
+        fsob_writer_abort(aborted[i]);
+    }
+}
+
+static bool path_conflicts(const char *a, const char *b) {
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    size_t len = len_a < len_b ? len_a : len_b;
+    return strncmp(a, b, len) == 0;     //Same file, or one is a directory containing the other
+}
+
+static bool request_conflicts(fsob_request_t *req, bool appfs, const char *path_a, const char *path_b) {
+    if(req->appfs || appfs) return req->appfs && appfs;
+    if(path_a && path_conflicts(req->path, path_a)) return true;
+    if(path_b && path_conflicts(req->path, path_b)) return true;
+    return false;
+}
+
+//Commands of which the payload starts with a filename
+static bool command_has_path(uint16_t command) {
+    if(command >= FILEFUNCTIONSBASE+GETDIR && command <= FILEFUNCTIONSBASE+MAKEDIR) return true;
+    return command == FILEFUNCTIONSBASE+GETDIREX || command == FILEFUNCTIONSBASE+FILEBLOCKHASH || command == FILEFUNCTIONSBASE+READRANGE || command == FILEFUNCTIONSBASE+TAREXPORT || command == FILEFUNCTIONSBASE+WATCH;
+}
+
+//Answers of the host to /host requests of the badge, they observe nothing on the badge
+static bool command_is_host_answer(uint16_t command) {
+    return command >= FILEFUNCTIONSBASE+HOSTOPEN && command <= FILEFUNCTIONSBASE+HOSTCLOSE;
+}
+
+//Commands streamed through the writer task, which already executes them in order
+static bool command_is_write(uint16_t command) {
+    switch(command) {
+        case FILEFUNCTIONSBASE+WRITEFILE:
+        case FILEFUNCTIONSBASE+APPFSWRITE:
+        case FILEFUNCTIONSBASE+WRITEDELTA:
+        case FILEFUNCTIONSBASE+WRITEPART:
+        case FILEFUNCTIONSBASE+APPFSWRITEPART:
+        case FILEFUNCTIONSBASE+TARIMPORT:
+        case FILEFUNCTIONSBASE+APPFSDEPLOY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+* Wait until every in flight request that could be observed by the command is completed.
+* Commands on unrelated paths continue straight away.
+*/
+void fsob_request_order(uint16_t command, uint8_t *data, uint32_t size) {
+    char path_a[256] = "";
+    char path_b[256] = "";
+    bool use_a = false, use_b = false, appfs = false, all = false;
+
+    if(command == SPECIALFUNCTIONSBASE+HEARTBEAT || command_is_write(command) || command_is_host_answer(command)) {
+        return;
+    } else if(command == FILEFUNCTIONSBASE+APPFSDIR || command == FILEFUNCTIONSBASE+APPFSDEL || command == FILEFUNCTIONSBASE+APPFSREAD) {
+        appfs = true;
+    } else if(command_has_path(command) && size > 0 && strnlen((char *) data, size) < 240) {
+        buildfile((char *) data, path_a);
+        use_a = true;
+        if(command == FILEFUNCTIONSBASE+DUPLFILE || command == FILEFUNCTIONSBASE+MVFILE) {
+            uint32_t offset = strlen((char *) data) + 1;
+            if(offset < size && strnlen((char *) &data[offset], size-offset) < 240) {
+                buildfile((char *) &data[offset], path_b);
+                use_b = true;
+            }
+        }
+    } else {
+        all = true;
+    }
+
+    for(;;) {
+        bool busy = false;
+        requests_lock();
+        for(int i = 0; i < CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS && !busy; i++) {
+            if(!requests[i].in_use || requests[i].receiving) continue;
+            busy = all || request_conflicts(&requests[i], appfs, use_a ? path_a : NULL, use_b ? path_b : NULL);
+        }
+        requests_unlock();
+        if(!busy) return;
+        xSemaphoreTake(requests_changed, pdMS_TO_TICKS(100));
+    }
+}
@@ -1,5 +1,7 @@
 #include "include/packetutils.h"
 #include "include/specialfunctions.h"
+#include "include/channels.h"
+#include "include/baudrate.h"
 
 #include <esp_sleep.h>
 #include <esp_err.h>
@@ -31,13 +33,22 @@ int execfile(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size
 
 int heartbeat(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
     if(received != size) return 0;
+    fsob_baud_confirm();
     sendok(command, message_id);
     return 1;
 }
 
-//Old function used in CZ20, currently unsupported. Function still exists to prevent reuse of the command.
+/*
+* Old function used in CZ20. The data is passed on as console input, read by the firmware with fsob_console_read.
+* Replies ns while nothing in the firmware reads console input.
+*/
 int pythonstdin(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
-    sendok(command, message_id);
+    if(!fsob_console_has_reader()) {
+        if(received == size) sendns(command, message_id);
+        return 1;
+    }
+    fsob_console_input(data, length);
+    if(received == size) sendok(command, message_id);
     return 1;
 }
 
@@ -0,0 +1,295 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "include/fsob_backend.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+#include "include/stats.h"
+
+#define TAG "fsob_stats"
+
+#if CONFIG_DRIVER_FSOVERBUS_STATS
+#define STATS_COMMANDS (SPECIALFUNCTIONSLEN + FILEFUNCTIONSLEN)
+#define STATS_ACTIVE   (CONFIG_DRIVER_FSOVERBUS_MAX_REQUESTS + 2)
+#define STATS_ENTRY_SIZE (2 + 4 + 6*8 + 2*STATS_BUCKETS*4)
+
+typedef struct {
+    uint32_t count;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t receive_us;
+    uint64_t handler_us;
+    uint64_t flash_us;
+    uint64_t total_us;
+    uint32_t ttfb[STATS_BUCKETS];
+    uint32_t total[STATS_BUCKETS];
+} stats_command_t;
+
+//Packet that is being received or executed
+typedef struct {
+    bool in_use;
+    bool received;
+    bool replied;
+    uint16_t index;
+    uint32_t message_id;
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    int64_t start;
+    int64_t receive_us;
+    int64_t handler_us;
+    int64_t flash_us;
+    int64_t ttfb_us;
+} stats_active_t;
+
+static stats_command_t stats[STATS_COMMANDS];
+static stats_active_t active[STATS_ACTIVE];
+static SemaphoreHandle_t stats_mutex = NULL;
+
+void fsob_stats_init(void) {
+    if(stats_mutex == NULL) stats_mutex = xSemaphoreCreateMutex();
+    memset(stats, 0, sizeof(stats));
+    memset(active, 0, sizeof(active));
+}
+
+static void stats_lock(void) {
+    xSemaphoreTake(stats_mutex, portMAX_DELAY);
+}
+
+static void stats_unlock(void) {
+    xSemaphoreGive(stats_mutex);
+}
+
+//Index of command in the statistics table, -1 when the command is not tracked
+static int stats_index(uint16_t command) {
+    uint16_t function = command & ~COMPRESSEDFLAG;
+    if(function < SPECIALFUNCTIONSLEN) return function;
+    if(function >= FILEFUNCTIONSBASE && function - FILEFUNCTIONSBASE < FILEFUNCTIONSLEN) return SPECIALFUNCTIONSLEN + function - FILEFUNCTIONSBASE;
+    return -1;
+}
+
+static uint16_t stats_command(int index) {
+    if(index < SPECIALFUNCTIONSLEN) return SPECIALFUNCTIONSBASE + index;
+    return FILEFUNCTIONSBASE + index - SPECIALFUNCTIONSLEN;
+}
+
+static int stats_bucket(int64_t us) {
+    int bucket = 0;
+    us >>= STATS_BUCKET_SHIFT;
+    while(us > 0 && bucket < STATS_BUCKETS-1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static stats_active_t *stats_find(uint32_t message_id) {
+    for(int i = 0; i < STATS_ACTIVE; i++) {
+        if(active[i].in_use && active[i].message_id == message_id) return &active[i];
+    }
+    return NULL;
+}
+
+/*
+* First chunk of a packet arrived. A packet that was still being received was cut off and is not counted.
+* When every slot is taken the oldest packet is dropped, its reply got lost.
+*/
+void fsob_stats_begin(uint16_t command, uint32_t message_id, uint32_t size) {
+    int index = stats_index(command);
+    if(stats_mutex == NULL || index < 0) return;
+
+    stats_lock();
+    stats_active_t *slot = NULL;
+    for(int i = 0; i < STATS_ACTIVE; i++) {
+        if(active[i].in_use && !active[i].received) active[i].in_use = false;
+        if(!active[i].in_use && slot == NULL) slot = &active[i];
+    }
+    if(slot == NULL) {
+        slot = &active[0];
+        for(int i = 1; i < STATS_ACTIVE; i++) {
+            if(active[i].start < slot->start) slot = &active[i];
+        }
+    }
+    memset(slot, 0, sizeof(stats_active_t));
+    slot->in_use = true;
+    slot->index = index;
+    slot->message_id = message_id;
+    slot->bytes_in = size;
+    slot->start = esp_timer_get_time();
+    stats_unlock();
+}
+
+void fsob_stats_received(uint32_t message_id) {
+    if(stats_mutex == NULL) return;
+    stats_lock();
+    stats_active_t *slot = stats_find(message_id);
+    if(slot && !slot->received) {
+        slot->received = true;
+        slot->receive_us = esp_timer_get_time() - slot->start;
+    }
+    stats_unlock();
+}
+
+void fsob_stats_handler(uint32_t message_id, int64_t us) {
+    if(stats_mutex == NULL) return;
+    stats_lock();
+    stats_active_t *slot = stats_find(message_id);
+    if(slot) slot->handler_us += us;
+    stats_unlock();
+}
+
+void fsob_stats_flash(uint32_t message_id, int64_t us) {
+    if(stats_mutex == NULL) return;
+    stats_lock();
+    stats_active_t *slot = stats_find(message_id);
+    if(slot) slot->flash_us += us;
+    stats_unlock();
+}
+
+//Called for every reply header, the first one ends the time to first byte
+void fsob_stats_reply(uint32_t message_id, uint32_t size) {
+    if(stats_mutex == NULL) return;
+    stats_lock();
+    stats_active_t *slot = stats_find(message_id);
+    if(slot) {
+        if(!slot->replied) {
+            slot->replied = true;
+            slot->ttfb_us = esp_timer_get_time() - slot->start;
+        }
+        slot->bytes_out += size;
+    }
+    stats_unlock();
+}
+
+/*
+* Request is complete, add it to the statistics of its command. Calling this for a request that was already counted does nothing.
+*/
+void fsob_stats_end(uint32_t message_id) {
+    if(stats_mutex == NULL) return;
+    stats_lock();
+    stats_active_t *slot = stats_find(message_id);
+    if(slot && slot->received) {
+        int64_t total_us = esp_timer_get_time() - slot->start;
+        stats_command_t *entry = &stats[slot->index];
+        entry->count++;
+        entry->bytes_in += slot->bytes_in;
+        entry->bytes_out += slot->bytes_out;
+        entry->receive_us += slot->receive_us;
+        entry->handler_us += slot->handler_us;
+        entry->flash_us += slot->flash_us;
+        entry->total_us += total_us;
+        entry->ttfb[stats_bucket(slot->replied ? slot->ttfb_us : total_us)]++;
+        entry->total[stats_bucket(total_us)]++;
+        slot->in_use = false;
+    }
+    stats_unlock();
+}
+
+static uint8_t *stats_put(uint8_t *p, const void *value, size_t length) {
+    memcpy(p, value, length);
+    return p + length;
+}
+
+/*
+* Response: 1 byte amount of histogram buckets, 1 byte log2 of the first bucket boundary in us and the 2 byte amount of entries.
+* Every command executed since the last reset has an entry: 2 byte command, 4 byte count, 8 byte bytes received and sent,
+* 8 byte summed receive, handler, flash and total time in us, followed by the time to first byte and total time histograms
+* as 4 byte counts per bucket.
+*/
+int getstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    uint8_t *reply = malloc(4 + STATS_COMMANDS * STATS_ENTRY_SIZE);
+    if(reply == NULL) {
+        sender(command, message_id);
+        return 1;
+    }
+
+    uint16_t entries = 0;
+    uint8_t *p = &reply[4];
+    stats_lock();
+    for(int i = 0; i < STATS_COMMANDS; i++) {
+        stats_command_t *entry = &stats[i];
+        if(entry->count == 0) continue;
+        uint16_t id = stats_command(i);
+        p = stats_put(p, &id, 2);
+        p = stats_put(p, &entry->count, 4);
+        p = stats_put(p, &entry->bytes_in, 8);
+        p = stats_put(p, &entry->bytes_out, 8);
+        p = stats_put(p, &entry->receive_us, 8);
+        p = stats_put(p, &entry->handler_us, 8);
+        p = stats_put(p, &entry->flash_us, 8);
+        p = stats_put(p, &entry->total_us, 8);
+        p = stats_put(p, entry->ttfb, sizeof(entry->ttfb));
+        p = stats_put(p, entry->total, sizeof(entry->total));
+        entries++;
+    }
+    stats_unlock();
+    reply[0] = STATS_BUCKETS;
+    reply[1] = STATS_BUCKET_SHIFT;
+    memcpy(&reply[2], &entries, 2);
+
+    uint32_t reply_size = p - reply;
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, command, reply_size, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) reply, reply_size);
+    fsob_tx_unlock();
+    free(reply);
+    return 1;
+}
+
+int resetstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    stats_lock();
+    memset(stats, 0, sizeof(stats));
+    stats_unlock();
+    ESP_LOGI(TAG, "Statistics reset");
+    sendok(command, message_id);
+    return 1;
+}
+#else
+void fsob_stats_init(void) {
+}
+
+void fsob_stats_begin(uint16_t command, uint32_t message_id, uint32_t size) {
+}
+
+void fsob_stats_received(uint32_t message_id) {
+}
+
+void fsob_stats_handler(uint32_t message_id, int64_t us) {
+}
+
+void fsob_stats_flash(uint32_t message_id, int64_t us) {
+}
+
+void fsob_stats_reply(uint32_t message_id, uint32_t size) {
+}
+
+void fsob_stats_end(uint32_t message_id) {
+}
+
+int getstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+    sendns(command, message_id);
+    return 1;
+}
+
+int resetstats(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+    sendns(command, message_id);
+    return 1;
+}
+#endif
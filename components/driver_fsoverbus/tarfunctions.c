@@ -0,0 +1,399 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "include/fsob_backend.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+#include "include/requests.h"
+#include "include/tarfunctions.h"
+#include "include/writer.h"
+
+#define TAG "fsoveruart_tar"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define TAR_BLOCK     (512)
+#define TAR_PATH_MAX  (240)     //Longest path on the badge, leaves room for the .tmp suffix
+#define TAR_PADDING(size) ((TAR_BLOCK - (size) % TAR_BLOCK) % TAR_BLOCK)
+
+/***
+ * Directory trees as ustar archives.
+ * tarexport streams a directory with all its contents as one archive, tarimport unpacks an archive into a directory.
+ * Names in the archive are relative to the directory. Imported files are written through the writer task like writefile,
+ * into a .tmp file that is renamed once complete, and get the modification time stored in the archive.
+ ***/
+
+struct fsob_tar {
+    char base[256];             //Target directory as sent by the host
+    uint8_t header[TAR_BLOCK];
+    uint32_t header_fill;
+    uint32_t remaining;         //Data of the current entry still to come
+    uint32_t padding;           //Bytes up to the next header
+    bool end;                   //End of archive marker seen, the rest is ignored
+};
+
+static bool tar_header(uint8_t *block, const char *name, char type, uint32_t size, uint32_t mtime) {
+    size_t length = strlen(name);
+    memset(block, 0, TAR_BLOCK);
+    if(length <= 100) {
+        memcpy(block, name, length);
+    } else {    //Longer names are split over the prefix and name fields at a directory separator
+        const char *split = NULL;
+        for(const char *p = name; *p && p - name <= 155; p++) {
+            if(*p == '/' && length - (p - name) - 1 <= 100 && p[1] != 0) {
+                split = p;
+                break;
+            }
+        }
+        if(split == NULL) return false;
+        memcpy(&block[345], name, split - name);
+        memcpy(block, split + 1, length - (split - name) - 1);
+    }
+    snprintf((char *) &block[100], 8, "%07o", type == '5' ? 0755 : 0644);
+    snprintf((char *) &block[108], 8, "%07o", 0);
+    snprintf((char *) &block[116], 8, "%07o", 0);
+    snprintf((char *) &block[124], 12, "%011o", size);
+    snprintf((char *) &block[136], 12, "%011o", mtime);
+    block[156] = type;
+    memcpy(&block[257], "ustar", 6);
+    memcpy(&block[263], "00", 2);
+
+    uint32_t checksum = 0;
+    memset(&block[148], ' ', 8);
+    for(int i = 0; i < TAR_BLOCK; i++) checksum += block[i];
+    snprintf((char *) &block[148], 8, "%06o", checksum);
+    block[155] = ' ';
+    return true;
+}
+
+static uint32_t tar_octal(const uint8_t *field, size_t length) {
+    uint32_t value = 0;
+    for(size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+/***
+ * Export side
+ ***/
+
+/*
+* The archive is walked once into a list of entries, its length is needed for the packet header before anything is sent.
+* Files are sent with the size recorded in the list, padded with zeros when they got shorter and cut off when they grew.
+*/
+typedef struct {
+    char *name;         //Relative to the exported directory, directories end with "/"
+    char type;
+    uint32_t size;
+    uint32_t mtime;
+} tar_item_t;
+
+typedef struct {
+    tar_item_t *items;
+    uint32_t count;
+    uint32_t capacity;
+} tar_list_t;
+
+static bool tar_list_add(tar_list_t *list, const char *name, char type, uint32_t size, uint32_t mtime) {
+    if(list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 32;
+        tar_item_t *items = realloc(list->items, capacity * sizeof(tar_item_t));
+        if(items == NULL) return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(name);
+    if(copy == NULL) return false;
+    list->items[list->count++] = (tar_item_t) {copy, type, size, mtime};
+    return true;
+}
+
+static void tar_list_free(tar_list_t *list) {
+    for(uint32_t i = 0; i < list->count; i++) free(list->items[i].name);
+    free(list->items);
+}
+
+//Returns false when memory ran out and the list is incomplete
+static bool tar_walk(tar_list_t *list, uint8_t *block, const char *path, const char *relative) {
+    DIR *d = opendir(path);
+    if(d == NULL) return true;
+    char *entry_path = malloc(512);
+    char *entry_name = malloc(512);
+    bool ok = entry_path != NULL && entry_name != NULL;
+    struct dirent *dir;
+    while(ok && (dir = readdir(d)) != NULL) {
+        if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+        snprintf(entry_path, 512, "%s/%s", path, dir->d_name);
+        snprintf(entry_name, 512, "%s%s", relative, dir->d_name);
+        struct stat st;
+        if(stat(entry_path, &st) != 0) continue;
+        bool is_dir = S_ISDIR(st.st_mode);
+        if(is_dir) strcat(entry_name, "/");
+        uint32_t entry_size = is_dir ? 0 : st.st_size;
+        if(!tar_header(block, entry_name, is_dir ? '5' : '0', entry_size, st.st_mtime)) {
+            ESP_LOGI(TAG, "Name too long for the archive: %s", entry_name);
+            continue;
+        }
+        ok = tar_list_add(list, entry_name, is_dir ? '5' : '0', entry_size, st.st_mtime);
+        if(ok && is_dir) ok = tar_walk(list, block, entry_path, entry_name);
+    }
+    closedir(d);
+    free(entry_path);
+    free(entry_name);
+    return ok;
+}
+
+static void tar_send(const tar_list_t *list, uint8_t *block, char *path, const char *base) {
+    for(uint32_t i = 0; i < list->count; i++) {
+        const tar_item_t *item = &list->items[i];
+        tar_header(block, item->name, item->type, item->size, item->mtime);
+        fsob_write_bytes((const char*) block, TAR_BLOCK);
+        if(item->size == 0) continue;
+        snprintf(path, 512, "%s/%s", base, item->name);
+        FILE *fptr = fopen(path, "r");
+        streamfile(fptr, item->size);
+        if(fptr) fclose(fptr);
+        memset(block, 0, TAR_BLOCK);
+        fsob_write_bytes((const char*) block, TAR_PADDING(item->size));
+    }
+}
+
+/*
+* Datafield: the directory to export.
+* Response: ustar archive of everything in the directory, names relative to it, ended by two zero blocks.
+*/
+int tarexport(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    char dir_name[256];
+    dir_name[0] = 0;
+    if(strlen((char *) data) <= TAR_PATH_MAX) buildfile((char *) data, dir_name);
+    size_t dir_length = strlen(dir_name);
+    while(dir_length > 1 && dir_name[dir_length-1] == '/') dir_name[--dir_length] = 0;
+    struct stat st;
+    tar_list_t list = {NULL, 0, 0};
+    uint8_t *block = malloc(TAR_BLOCK);
+    char *path = malloc(512);
+    if(block == NULL || path == NULL || dir_length == 0 || stat(dir_name, &st) != 0 || !S_ISDIR(st.st_mode)
+            || !tar_walk(&list, block, dir_name, "")) {
+        tar_list_free(&list);
+        free(block);
+        free(path);
+        sender(command, message_id);
+        return 1;
+    }
+
+    uint32_t archive_size = 2*TAR_BLOCK;
+    for(uint32_t i = 0; i < list.count; i++) {
+        archive_size += TAR_BLOCK + list.items[i].size + TAR_PADDING(list.items[i].size);
+    }
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, command, archive_size, message_id);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    tar_send(&list, block, path, dir_name);
+    memset(block, 0, TAR_BLOCK);
+    fsob_write_bytes((const char*) block, TAR_BLOCK);
+    fsob_write_bytes((const char*) block, TAR_BLOCK);
+    fsob_tx_unlock();
+    tar_list_free(&list);
+    free(block);
+    free(path);
+    return 1;
+}
+
+/***
+ * Import side
+ ***/
+
+//Create every missing directory of path, which is a path on the badge
+static void tar_mkdirs(char *path) {
+    if(path[0] == 0) return;
+    for(char *p = &path[1]; *p; p++) {
+        if(*p != '/') continue;
+        *p = 0;
+        mkdir(path, 0775);
+        *p = '/';
+    }
+    mkdir(path, 0775);
+}
+
+static bool tar_name_safe(const char *name) {
+    if(name[0] == '/') return false;
+    for(const char *p = name; *p; ) {
+        const char *end = strchr(p, '/');
+        size_t length = end ? end - p : strlen(p);
+        if(length == 2 && strncmp(p, "..", 2) == 0) return false;
+        if(end == NULL) break;
+        p = end + 1;
+    }
+    return true;
+}
+
+static void tar_fail(fsob_request_t *req) {
+    if(req->write_ctx) fsob_writer_abort(req->write_ctx);
+    req->write_ctx = NULL;
+    req->failed = true;
+}
+
+static void tar_import_header(fsob_request_t *req) {
+    struct fsob_tar *tar = req->tar;
+    uint8_t *header = tar->header;
+
+    bool empty = true;
+    for(int i = 0; i < TAR_BLOCK && empty; i++) empty = header[i] == 0;
+    if(empty) {
+        tar->end = true;
+        return;
+    }
+
+    uint32_t checksum = 0;
+    for(int i = 0; i < TAR_BLOCK; i++) checksum += (i >= 148 && i < 156) ? ' ' : header[i];
+    if(checksum != tar_octal(&header[148], 8)) {
+        ESP_LOGI(TAG, "Archive header checksum mismatch");
+        tar_fail(req);
+        return;
+    }
+
+    char prefix[156];
+    char name[sizeof(prefix) + 1 + 100];    //Prefix, separator and a name of at most 100 characters
+    memcpy(prefix, &header[345], 155);
+    prefix[155] = 0;
+    snprintf(name, sizeof(name), "%s%s%.100s", prefix, prefix[0] ? "/" : "", (char *) header);
+    uint32_t size = tar_octal(&header[124], 12);
+    uint32_t mtime = tar_octal(&header[136], 12);
+    char type = header[156];
+    tar->remaining = size;
+    tar->padding = TAR_PADDING(size);
+
+    char *entry = name;
+    if(strncmp(entry, "./", 2) == 0) entry += 2;
+    size_t length = strlen(entry);
+    while(length > 0 && entry[length-1] == '/') entry[--length] = 0;
+    if(type != '0' && type != 0 && type != '5') {
+        ESP_LOGI(TAG, "Skipping archive entry %s of type %c", entry, type);
+        return;
+    }
+    if(length == 0) return;     //The directory itself
+
+    char path[512];
+    char badge_path[256];
+    snprintf(path, sizeof(path), "%s/%s", tar->base, entry);
+    if(!tar_name_safe(entry) || strlen(path) > TAR_PATH_MAX) {
+        ESP_LOGI(TAG, "Refusing archive entry %s", entry);
+        tar_fail(req);
+        return;
+    }
+    badge_path[0] = 0;
+    buildfile(path, badge_path);
+
+    if(type == '5') {
+        tar_mkdirs(badge_path);
+        return;
+    }
+    char *separator = strrchr(badge_path, '/');
+    if(separator && separator != badge_path) {
+        *separator = 0;
+        tar_mkdirs(badge_path);
+    }
+    req->write_ctx = fsob_writer_open_file(path);
+    if(req->write_ctx == NULL) {
+        tar_fail(req);
+        return;
+    }
+    fsob_writer_set_mtime(req->write_ctx, mtime);
+    if(size == 0) {
+        fsob_writer_close(req->write_ctx, req->message_id);
+        req->write_ctx = NULL;
+    }
+}
+
+static void tar_import_data(fsob_request_t *req, const uint8_t *data, uint32_t length) {
+    struct fsob_tar *tar = req->tar;
+    while(length > 0 && !req->failed && !tar->end) {
+        uint32_t chunk;
+        if(tar->remaining > 0) {
+            chunk = min(tar->remaining, length);
+            if(req->write_ctx) fsob_request_write(req, data, chunk);
+            tar->remaining -= chunk;
+            if(tar->remaining == 0 && req->write_ctx) {
+                fsob_writer_close(req->write_ctx, req->message_id);
+                req->write_ctx = NULL;
+            }
+        } else if(tar->padding > 0) {
+            chunk = min(tar->padding, length);
+            tar->padding -= chunk;
+        } else {
+            chunk = min(TAR_BLOCK - tar->header_fill, length);
+            memcpy(&tar->header[tar->header_fill], data, chunk);
+            tar->header_fill += chunk;
+            if(tar->header_fill == TAR_BLOCK) {
+                tar->header_fill = 0;
+                tar_import_header(req);
+            }
+        }
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+/*
+* Datafield: target directory, 0 terminated, followed by a ustar archive. Directories are created as needed,
+* entries other than files and directories are skipped. Replies once every file is stored.
+*/
+int tarimport(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    fsob_request_t *req;
+    if(received == length) {
+        req = fsob_request_open(command, message_id);
+    } else {
+        req = fsob_request_find(message_id);
+        if(req == NULL) return 1;   //Request got aborted, drop the remaining payload
+    }
+
+    if(req->tar == NULL && !req->failed) {
+        uint32_t i;
+        for(i = 0; i < received && data[i] != 0; i++);
+        if(i == received) return 0;   //Directory not complete yet
+
+        req->tar = calloc(1, sizeof(struct fsob_tar));
+        if(i > 200 || req->tar == NULL) {
+            req->failed = true;
+        } else {
+            strcpy(req->tar->base, (char *) data);
+            size_t base_length = strlen(req->tar->base);
+            while(base_length > 1 && req->tar->base[base_length-1] == '/') req->tar->base[--base_length] = 0;
+            buildfile(req->tar->base, req->path);
+            if(req->path[0] == 0) {     //Not below a mounted filesystem, nothing in the archive has a place to go
+                ESP_LOGI(TAG, "Refusing archive target %s", req->tar->base);
+                free(req->tar);
+                req->tar = NULL;
+                fsob_request_received(req);
+                sender(command, message_id);
+                fsob_request_close(message_id);
+                return 1;   //Remaining payload finds no request and is dropped
+            }
+            tar_import_data(req, &data[i+1], received-i-1);
+        }
+    } else if(req->tar) {
+        tar_import_data(req, data, length);
+    }
+
+    if(received == size) {
+        struct fsob_tar *tar = req->tar;
+        if(tar && (tar->remaining > 0 || tar->header_fill > 0)) tar_fail(req);     //Archive was cut off
+        if(req->write_ctx) tar_fail(req);
+        free(tar);
+        req->tar = NULL;
+        bool failed = req->failed;
+        fsob_request_received(req);
+        fsob_writer_reply(command, message_id, failed);   //Sent by the writer task once all files are stored
+    }
+    return 1;
+}
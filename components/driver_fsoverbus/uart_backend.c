@@ -1,5 +1,6 @@
 #include "include/fsob_backend.h"
 #include "include/driver_fsoverbus.h"
+#include "include/flowcontrol.h"
 #include <driver/gpio.h>
 #include <driver/uart.h>
 #include <soc/uart_reg.h>
@@ -41,11 +42,15 @@ uint32_t min(uint32_t a, uint32_t b) {
     return a < b ? a : b;
 }
 
+/*
+* Hold off the host by driving CTS high. Only used for hosts that did not enable credit based flow control.
+*/
 void fixcts(bool high) {
+    if(fsob_flow_enabled()) high = false;
     uint32_t data_buf = 0;
     uart_get_buffered_data_len(CONFIG_DRIVER_FSOVERBUS_UART_NUM, &data_buf);
     ESP_LOGD(TAG, "buf: %d", data_buf);
-    if(high || data_buf > CONFIG_DRIVER_FSOVERBUS_UART_BUFFER_SIZE/4) {
+    if(high || (!fsob_flow_enabled() && data_buf > CONFIG_DRIVER_FSOVERBUS_UART_BUFFER_SIZE/4)) {
         gpio_pad_select_gpio(CONFIG_DRIVER_FSOVERBUS_UART_CTS);
         gpio_set_direction(CONFIG_DRIVER_FSOVERBUS_UART_CTS, GPIO_MODE_OUTPUT);
         gpio_set_level(CONFIG_DRIVER_FSOVERBUS_UART_CTS, 1);
@@ -83,6 +88,7 @@ void fsoveruartTask(void *pvParameter) {
                             if((event.size-bytesread) < PACKET_HEADER_SIZE) break; //Break while loop if non complete header is inside
                             uart_read_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, dtmp, PACKET_HEADER_SIZE, portMAX_DELAY);
                             bytesread += PACKET_HEADER_SIZE;
+                            fsob_flow_consumed(PACKET_HEADER_SIZE);
                             command = *((uint16_t *) &dtmp[0]);
                             size = *((uint32_t *) &dtmp[2]);
                             verif = *((uint16_t *) &dtmp[6]);
@@ -105,6 +111,7 @@ void fsoveruartTask(void *pvParameter) {
                             bytestoread = uart_read_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, dtmp, bytestoread, portMAX_DELAY);
                             recv = recv + bytestoread;
                             bytesread += bytestoread;
+                            fsob_flow_consumed(bytestoread);
                             ESP_LOGI(TAG, "processing packet: %d %d %d %d %d", command, size, recv, verif, bytestoread);
                             fixcts(true);
                             handleFSCommand(dtmp, command, message_id, size, recv, bytestoread);
@@ -171,6 +178,7 @@ void fsob_init() {
     uart_param_config(CONFIG_DRIVER_FSOVERBUS_UART_NUM, &uart_config);   //Configure the uart hardware
     uart_set_pin(CONFIG_DRIVER_FSOVERBUS_UART_NUM, CONFIG_DRIVER_FSOVERBUS_UART_TX, CONFIG_DRIVER_FSOVERBUS_UART_RX, CONFIG_DRIVER_FSOVERBUS_UART_CTS, -1); //Change pins
     uart_driver_install(CONFIG_DRIVER_FSOVERBUS_UART_NUM, CONFIG_DRIVER_FSOVERBUS_UART_BUFFER_SIZE, CONFIG_DRIVER_FSOVERBUS_UART_BUFFER_SIZE, 40, &uart_queue, 0); //Install driver
+    fsob_flow_set_window(CONFIG_DRIVER_FSOVERBUS_UART_BUFFER_SIZE - 128);
 
     uart_intr_config_t uart_intr = {
         .intr_enable_mask = UART_RXFIFO_FULL_INT_ENA_M
@@ -1,5 +1,11 @@
 #include "include/fsob_backend.h"
 #include "include/driver_fsoverbus.h"
+#include "include/flowcontrol.h"
+#include "include/crcmode.h"
+#include "include/channels.h"
+#include "include/baudrate.h"
+#include "include/packetutils.h"
+#include "include/requests.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <driver/uart.h>
@@ -9,10 +15,44 @@
 
 #if (CONFIG_DRIVER_FSOVERBUS_BACKEND == 2)
 
+#define UART_RX_BUFFER_SIZE (16*1024)
+#define UART_CHUNK_SLACK_MS (100)
+#define UART_HW_FIFO_SIZE   (128)
+
+static int fsob_uart_read_raw(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    int read = uart_read_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, buffer, length, pdMS_TO_TICKS(timeout_ms));
+    if (read > 0) fsob_flow_consumed(read);
+    return read;
+}
+
+static void fsob_uart_write_raw(const uint8_t *src, uint32_t length) {
+    uart_write_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, (const char *) src, length);
+}
+
+//Read from the file channel when channels are enabled
+static int fsob_uart_read(uint8_t *buffer, uint32_t length, uint32_t timeout_ms) {
+    if (fsob_channels_enabled()) return fsob_channels_read(buffer, length, timeout_ms);
+    return fsob_uart_read_raw(buffer, length, timeout_ms);
+}
+
+/* Time a chunk may take, twice its time on the wire at the current rate plus room for gaps on the host side */
+static uint32_t fsob_uart_chunk_timeout(uint32_t length) {
+    uint32_t baud = fsob_baud_current();
+    if (baud == 0) baud = CONFIG_DRIVER_FSOVERBUS_UART_BAUD;
+    return (uint32_t) (((uint64_t) length * 10 * 1000 * 2) / baud) + UART_CHUNK_SLACK_MS;
+}
+
+/* Switch only once everything queued went out at the old rate, the TX buffer and the hardware FIFO can both be full */
+static bool fsob_uart_set_baud(uint32_t baud) {
+    uint32_t drain_ms = fsob_uart_chunk_timeout(CONFIG_DRIVER_FSOVERBUS_UART_TX_BUFFER_SIZE + UART_HW_FIFO_SIZE);
+    if (uart_wait_tx_done(CONFIG_DRIVER_FSOVERBUS_UART_NUM, pdMS_TO_TICKS(drain_ms)) != ESP_OK) return false;
+    return uart_set_baudrate(CONFIG_DRIVER_FSOVERBUS_UART_NUM, baud) == ESP_OK;
+}
+
 bool fsob_uart_sync(uint32_t* size, uint16_t* command, uint32_t* message_id) {
     uint16_t verif = 0; //Verif field
     uint8_t rx_buffer[12];
-    int read = uart_read_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, rx_buffer, sizeof(rx_buffer), pdMS_TO_TICKS(1000));
+    int read = fsob_uart_read(rx_buffer, sizeof(rx_buffer), 1000);
     if (read != sizeof(rx_buffer)) return false;
     verif = *((uint16_t *) &rx_buffer[6]);
     if (verif != 0xADDE) return false;
@@ -25,40 +65,58 @@ bool fsob_uart_sync(uint32_t* size, uint16_t* command, uint32_t* message_id) {
 void fsob_task(void *pvParameter) {
     uint32_t size, message_id;
     uint16_t command;
+    uint8_t* buffer = malloc(CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate buffer");
+        vTaskDelete(NULL);
+        return;
+    }
     
     while (true) {
+        fsob_baud_poll();
+
+        // 0) CRC mode uses its own framing
+        if (fsob_crc_enabled()) {
+            fsob_crc_receive(buffer);
+            continue;
+        }
+
         // 1) Wait for webusb header
         while (!fsob_uart_sync(&size, &command, &message_id)) {
+            fsob_baud_poll();
             vTaskDelay(10);
         }
 
-        // 2) Allocate RAM for the data to be received if there is a payload
-        uint8_t* buffer = NULL;
-        if (size > 0) {
-            buffer = malloc(size);
-            if (buffer == NULL) {
-                ESP_LOGI(TAG, "Failed to allocate buffer");
-                continue;
-            }
+        // 2) Commands without payload are handled directly
+        if (size == 0) {
+            handleFSCommand(buffer, command, message_id, 0, 0, 0);
+            continue;
+        }
 
-            // 3) Receive data into the buffer
-            int read = uart_read_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, buffer, size, pdMS_TO_TICKS(50));
-            if (read != size) {
-                free(buffer);
+        // 3) Receive the payload in chunks and hand every chunk over while the next one is arriving
+        uint32_t received = 0;
+        while (received < size) {
+            uint32_t chunk = size - received;
+            if (chunk > CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE) chunk = CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE;
+            int read = fsob_uart_read(buffer, chunk, fsob_uart_chunk_timeout(chunk));
+            if (read != chunk) {
                 ESP_LOGI(TAG, "Failed to read all data");
-                continue;
+                fsob_request_abort_receiving();
+                sender(command, message_id);
+                break;
             }
-        }
-
-        handleFSCommand(buffer, command, message_id, size, size, size);
-        if(buffer != NULL) {
-            free(buffer);
+            received += read;
+            handleFSCommand(buffer, command, message_id, size, received, read);
         }
     }
 }
 
 void fsob_init() {
-    ESP_ERROR_CHECK(uart_driver_install(CONFIG_DRIVER_FSOVERBUS_UART_NUM, 16*1024, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(CONFIG_DRIVER_FSOVERBUS_UART_NUM, UART_RX_BUFFER_SIZE, CONFIG_DRIVER_FSOVERBUS_UART_TX_BUFFER_SIZE, 0, NULL, 0));
+    fsob_flow_set_window(UART_RX_BUFFER_SIZE - UART_HW_FIFO_SIZE);  //Keep room for what is still in the hardware FIFO
+    fsob_crc_attach(fsob_uart_read);
+    fsob_channels_attach(fsob_uart_read_raw, fsob_uart_write_raw);
+    fsob_baud_attach(fsob_uart_set_baud, CONFIG_DRIVER_FSOVERBUS_UART_BAUD);
     uart_config_t uart_config = {
         .baud_rate  = CONFIG_DRIVER_FSOVERBUS_UART_BAUD,
         .data_bits  = UART_DATA_8_BITS,
@@ -77,7 +135,11 @@ void fsob_reset() {
 }
 
 void fsob_write_bytes(const char *src, size_t size) {
-    uart_write_bytes(CONFIG_DRIVER_FSOVERBUS_UART_NUM, src, size);
+    if (fsob_channels_enabled()) {
+        fsob_channels_write((const uint8_t *) src, size);
+    } else {
+        fsob_uart_write_raw((const uint8_t *) src, size);
+    }
 }
 
 #endif
\ No newline at end of file
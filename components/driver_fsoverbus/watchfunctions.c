@@ -0,0 +1,244 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "include/fsob_backend.h"
+#include "include/functions.h"
+#include "include/packetutils.h"
+#include "include/watchfunctions.h"
+
+#define TAG "fsoveruart_watch"
+
+#if CONFIG_DRIVER_FSOVERBUS_WATCH
+#define WATCH_ENTRIES  (CONFIG_DRIVER_FSOVERBUS_WATCH_ENTRIES)
+#define WATCH_INTERVAL (CONFIG_DRIVER_FSOVERBUS_WATCH_INTERVAL)
+#define WATCH_PATH_MAX (240)
+#define WATCH_BATCH    (CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE)   //Largest event packet
+#define WATCH_EVENT_HEADER (7)  //Op, size, name length
+
+/***
+ * Change notifications for a directory the host mirrors.
+ * The VFS has no hooks for changes, so the watched directory is scanned every WATCH_INTERVAL ms and compared with the size and
+ * modification time seen in the previous scan. Changes are sent in batches as packets with message id 0, so the host only has to
+ * sync the files named in them instead of listing the whole tree. Changes made over the bus are reported like any other.
+ ***/
+
+typedef struct {
+    char *name;         //Relative to the watched directory
+    uint32_t size;
+    uint32_t mtime;
+    bool seen;
+} watch_entry_t;
+
+static SemaphoreHandle_t watch_lock = NULL;
+static bool watch_active = false;
+static char watch_host[256];        //Directory as sent by the host, event names start with it
+static char watch_dir[256];         //Same directory on the badge
+static watch_entry_t *entries = NULL;
+static uint32_t entry_count = 0;
+static bool entries_full = false;
+
+//Events of the running scan, only used with watch_lock held
+static uint8_t *batch = NULL;
+static uint32_t batch_fill = 4;
+static uint32_t batch_events = 0;
+
+static void watch_flush(void) {
+    if(batch_events == 0) return;
+    memcpy(batch, &batch_events, 4);
+    uint8_t header[PACKET_HEADER_SIZE];
+    createMessageHeader(header, FILEFUNCTIONSBASE+WATCH, batch_fill, 0);
+    fsob_tx_lock();
+    fsob_write_header(header);
+    fsob_write_bytes((const char*) batch, batch_fill);
+    fsob_tx_unlock();
+    batch_fill = 4;
+    batch_events = 0;
+}
+
+static void watch_event(char op, const char *name, uint32_t size) {
+    char path[512];
+    uint16_t length = snprintf(path, sizeof(path), "%s/%s", watch_host, name);
+    if(length >= sizeof(path)) return;
+    if(batch_fill + WATCH_EVENT_HEADER + length > WATCH_BATCH) watch_flush();
+    batch[batch_fill] = op;
+    memcpy(&batch[batch_fill+1], &size, 4);
+    memcpy(&batch[batch_fill+5], &length, 2);
+    memcpy(&batch[batch_fill+WATCH_EVENT_HEADER], path, length);
+    batch_fill += WATCH_EVENT_HEADER + length;
+    batch_events++;
+}
+
+static watch_entry_t *watch_find(const char *name) {
+    for(uint32_t i = 0; i < entry_count; i++) {
+        if(strcmp(entries[i].name, name) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+//Files being written are stored as .tmp until complete, they are reported once renamed
+static bool watch_ignored(const char *name) {
+    size_t length = strlen(name);
+    return length >= 4 && strcmp(&name[length-4], ".tmp") == 0;
+}
+
+static void watch_file(const char *name, const struct stat *st, bool report) {
+    watch_entry_t *entry = watch_find(name);
+    if(entry == NULL) {
+        if(entry_count == WATCH_ENTRIES) {
+            if(!entries_full) ESP_LOGW(TAG, "More than %d files, changes to the others are not reported", WATCH_ENTRIES);
+            entries_full = true;
+            return;
+        }
+        entry = &entries[entry_count];
+        entry->name = strdup(name);
+        if(entry->name == NULL) return;
+        entry_count++;
+        if(report) watch_event('c', name, st->st_size);
+    } else if(entry->size != st->st_size || entry->mtime != st->st_mtime) {
+        if(report) watch_event('m', name, st->st_size);
+    }
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtime;
+    entry->seen = true;
+}
+
+static void watch_walk(const char *path, const char *relative, bool report) {
+    DIR *d = opendir(path);
+    if(d == NULL) return;
+    char *entry_path = malloc(512);
+    char *entry_name = malloc(512);
+    struct dirent *dir;
+    while(entry_path && entry_name && (dir = readdir(d)) != NULL) {
+        if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
+        snprintf(entry_path, 512, "%s/%s", path, dir->d_name);
+        snprintf(entry_name, 512, "%s%s", relative, dir->d_name);
+        struct stat st;
+        if(stat(entry_path, &st) != 0) continue;
+        if(S_ISDIR(st.st_mode)) {
+            strcat(entry_name, "/");
+            watch_walk(entry_path, entry_name, report);
+        } else if(!watch_ignored(entry_name)) {
+            watch_file(entry_name, &st, report);
+        }
+    }
+    closedir(d);
+    free(entry_path);
+    free(entry_name);
+}
+
+//Compare the directory with the previous scan, caller holds watch_lock
+static void watch_scan(bool report) {
+    for(uint32_t i = 0; i < entry_count; i++) entries[i].seen = false;
+    watch_walk(watch_dir, "", report);
+    uint32_t i = 0;
+    while(i < entry_count) {
+        if(entries[i].seen) {
+            i++;
+            continue;
+        }
+        if(report) watch_event('d', entries[i].name, 0);
+        free(entries[i].name);
+        entries[i] = entries[--entry_count];
+        entries_full = false;   //Room again, files skipped before are picked up as created
+    }
+    watch_flush();
+}
+
+static void watch_clear(void) {
+    for(uint32_t i = 0; i < entry_count; i++) free(entries[i].name);
+    entry_count = 0;
+    entries_full = false;
+}
+
+static void watch_task(void *pvParameters) {
+    for(;;) {
+        vTaskDelay(pdMS_TO_TICKS(WATCH_INTERVAL));
+        xSemaphoreTake(watch_lock, portMAX_DELAY);
+        if(watch_active) watch_scan(true);
+        xSemaphoreGive(watch_lock);
+    }
+}
+
+static bool watch_init(void) {
+    if(watch_lock) return true;
+    entries = calloc(WATCH_ENTRIES, sizeof(watch_entry_t));
+    batch = malloc(WATCH_BATCH);
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    if(entries == NULL || batch == NULL || lock == NULL) {
+        free(entries);
+        free(batch);
+        if(lock) vSemaphoreDelete(lock);
+        entries = NULL;
+        batch = NULL;
+        return false;
+    }
+    watch_lock = lock;
+    if(xTaskCreatePinnedToCore(watch_task, "fsoverbus_watch", 4096, NULL, 3, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start watch task");
+    }
+    return true;
+}
+
+/*
+* Datafield: the directory to watch, an empty datafield stops watching. Watching another directory replaces the previous one.
+* Response: ok once the current state of the directory is recorded, every change afterwards is reported. er when it is not a directory.
+* Events: packets with this command and message id 0, carrying the 4 byte amount of events followed by the events.
+* Every event is an op byte (c created, m modified, d deleted), the 4 byte file size, 2 byte name length and the name.
+*/
+int watch(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+
+    if(!watch_init()) {
+        sender(command, message_id);
+        return 1;
+    }
+    char dir_name[256];
+    dir_name[0] = 0;
+    if(size > 0 && strlen((char *) data) <= WATCH_PATH_MAX) buildfile((char *) data, dir_name);
+    size_t dir_length = strlen(dir_name);
+    while(dir_length > 1 && dir_name[dir_length-1] == '/') dir_name[--dir_length] = 0;
+
+    xSemaphoreTake(watch_lock, portMAX_DELAY);
+    watch_active = false;
+    watch_clear();
+    bool ok = true;
+    if(size > 0 && data[0] != 0) {
+        struct stat st;
+        ok = dir_length > 0 && stat(dir_name, &st) == 0 && S_ISDIR(st.st_mode);
+        if(ok) {
+            strcpy(watch_dir, dir_name);
+            snprintf(watch_host, sizeof(watch_host), "%s", (char *) data);
+            size_t host_length = strlen(watch_host);
+            while(host_length > 0 && watch_host[host_length-1] == '/') watch_host[--host_length] = 0;
+            watch_scan(false);
+            watch_active = true;
+            ESP_LOGI(TAG, "Watching %s, %d files", watch_dir, entry_count);
+        }
+    }
+    xSemaphoreGive(watch_lock);
+
+    if(ok) {
+        sendok(command, message_id);
+    } else {
+        sender(command, message_id);
+    }
+    return 1;
+}
+#else
+int watch(uint8_t *data, uint16_t command, uint32_t message_id, uint32_t size, uint32_t received, uint32_t length) {
+    if(received != size) return 0;
+    sendns(command, message_id);
+    return 1;
+}
+#endif
@@ -0,0 +1,563 @@
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
+
+#include "include/writer.h"
+#include "include/requests.h"
+#include "include/packetutils.h"
+#include "include/appfsfunctions.h"
+#include "include/stats.h"
+
+#define TAG "fsob_writer"
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define WRITER_BUFFER_SIZE (CONFIG_DRIVER_FSOVERBUS_TRANSFER_SIZE)
+#define WRITER_BUFFERS     (CONFIG_DRIVER_FSOVERBUS_WRITER_BUFFERS)
+#define WRITER_QUEUE_LEN   (WRITER_BUFFERS*2+4)
+
+struct fsob_write_ctx {
+    bool appfs;
+    bool failed;
+    bool resumable;         //Written in parts, an incomplete file is kept so the host can continue it
+    bool final;             //Last part of a resumable file
+    uint32_t offset;        //Offset the first byte of this part is written at
+    FILE *fptr;
+    FILE *source;           //Existing file, opened when data gets copied from it
+    appfs_handle_t handle;
+    uint32_t size;          //AppFS file size
+    uint32_t written;
+    uint32_t erased;        //AppFS bytes erased so far
+    int64_t flash_us;       //Time the writer task spent on this file
+    uint32_t mtime;         //Modification time set once the file is complete, 0 keeps the current time
+    bool deploy;            //AppFS file is checked against hash once complete and booted
+    uint8_t hash[APPFS_HASH_SIZE];
+    char path[256];         //Final filename or AppFS name
+    char path_tmp[256];
+
+    //Only used by the receiving task
+    uint8_t *buffer;
+    uint32_t buffer_fill;
+};
+
+enum WRITER_OPS {
+    WRITER_OPEN = 0,
+    WRITER_DATA,
+    WRITER_COMMIT,
+    WRITER_ABORT,
+    WRITER_SYNC,
+    WRITER_COPY,
+    WRITER_CLOSE,
+    WRITER_REPLY
+};
+
+typedef struct {
+    uint8_t op;
+    uint16_t command;
+    uint32_t message_id;
+    fsob_write_ctx_t *ctx;
+    uint8_t *buffer;
+    uint32_t offset;
+    uint32_t length;
+    bool failed;
+    SemaphoreHandle_t done;
+} writer_job_t;
+
+static QueueHandle_t job_queue = NULL;
+static QueueHandle_t free_queue = NULL;
+static SemaphoreHandle_t sync_done = NULL;
+static uint8_t *copy_buffer = NULL;        //Owned by the writer task
+
+//AppFS upload that was cut off or is sent in parts. Only changed by the writer task.
+static struct {
+    char name[256];
+    uint32_t size;
+    uint32_t written;
+} appfs_resume;
+
+//Files of a request that stores more than one file, closed with WRITER_CLOSE. Only changed by the writer task.
+static uint32_t group_id;
+static bool group_failed;
+
+static void writer_send_job(uint8_t op, fsob_write_ctx_t *ctx, uint8_t *buffer, uint32_t length, uint16_t command, uint32_t message_id) {
+    writer_job_t job = {
+        .op = op,
+        .command = command,
+        .message_id = message_id,
+        .ctx = ctx,
+        .buffer = buffer,
+        .length = length,
+        .done = sync_done,
+    };
+    xQueueSend(job_queue, &job, portMAX_DELAY);
+}
+
+static void writer_release_buffer(uint8_t *buffer) {
+    if(buffer) xQueueSend(free_queue, &buffer, portMAX_DELAY);
+}
+
+/***
+ * Writer task side. These functions run on the writer task and are the only place where flash gets written.
+ ***/
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+/*
+* Continue an AppFS file where a previous part stopped. Only possible when the file still matches the saved state.
+*/
+static void writer_open_appfs_resume(fsob_write_ctx_t *ctx) {
+    if(strcmp(appfs_resume.name, ctx->path) != 0 || appfs_resume.size != ctx->size || appfs_resume.written != ctx->offset) {
+        ESP_LOGI(TAG, "AppFS resume of %s at %d does not match", ctx->path, ctx->offset);
+        ctx->failed = true;
+        return;
+    }
+    ctx->handle = appfsOpen(ctx->path);
+    if(ctx->handle == APPFS_INVALID_FD) {
+        appfs_resume.name[0] = 0;
+        ctx->failed = true;
+        return;
+    }
+    ctx->written = ctx->offset;
+    ctx->erased = (ctx->offset + SPI_FLASH_MMU_PAGE_SIZE - 1) / SPI_FLASH_MMU_PAGE_SIZE * SPI_FLASH_MMU_PAGE_SIZE;
+}
+#endif
+
+static void writer_open(fsob_write_ctx_t *ctx) {
+    if(ctx->appfs) {
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+        if(ctx->resumable && ctx->offset > 0) {
+            writer_open_appfs_resume(ctx);
+            return;
+        }
+        if(strcmp(appfs_resume.name, ctx->path) == 0) {
+            appfs_resume.name[0] = 0;   //File gets replaced, nothing to resume anymore
+        }
+        if(appfsCreateFile(ctx->path, ctx->size, &ctx->handle) != ESP_OK) {
+            ESP_LOGI(TAG, "AppFS create failed: %s", ctx->path);
+            ctx->handle = APPFS_INVALID_FD;
+            ctx->failed = true;
+        }
+#else
+        ctx->failed = true;
+#endif
+        return;
+    }
+
+    ESP_LOGI(TAG, "Writing: %s at %d", ctx->path_tmp, ctx->offset);
+    ctx->fptr = fopen(ctx->path_tmp, ctx->offset > 0 ? "a" : "w");
+    if(ctx->fptr == NULL) {
+        ESP_LOGI(TAG, "Open failed");
+        ctx->failed = true;
+        return;
+    }
+    if(ctx->offset > 0) {   //Parts have to continue exactly where the temporary file ends
+        fseek(ctx->fptr, 0, SEEK_END);
+        if(ftell(ctx->fptr) != ctx->offset) {
+            ESP_LOGI(TAG, "Resume offset %d does not match %ld", ctx->offset, ftell(ctx->fptr));
+            ctx->failed = true;
+        }
+    }
+}
+
+static void writer_data(fsob_write_ctx_t *ctx, uint8_t *buffer, uint32_t length) {
+    if(ctx->failed) return;
+
+    if(ctx->appfs) {
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+        if(ctx->written + length > ctx->size) {
+            ctx->failed = true;
+            return;
+        }
+        //Erase just ahead of the data instead of the complete file up front
+        while(ctx->erased < ctx->written + length) {
+            if(appfsErase(ctx->handle, ctx->erased, SPI_FLASH_MMU_PAGE_SIZE) != ESP_OK) {
+                ctx->failed = true;
+                return;
+            }
+            ctx->erased += SPI_FLASH_MMU_PAGE_SIZE;
+        }
+        if(appfsWrite(ctx->handle, ctx->written, buffer, length) != ESP_OK) {
+            ctx->failed = true;
+            return;
+        }
+#endif
+    } else if(fwrite(buffer, 1, length, ctx->fptr) != length) {
+        ESP_LOGI(TAG, "Write failed");
+        ctx->failed = true;
+        return;
+    }
+    ctx->written += length;
+}
+
+/*
+* Append length bytes of the existing file, starting at offset, to the file being written.
+* Copying stops at the end of the existing file.
+*/
+static void writer_copy(fsob_write_ctx_t *ctx, uint32_t offset, uint32_t length) {
+    if(ctx->failed) return;
+    if(ctx->appfs || copy_buffer == NULL) {
+        ctx->failed = true;
+        return;
+    }
+    if(ctx->source == NULL) {
+        ctx->source = fopen(ctx->path, "r");
+        if(ctx->source == NULL) {
+            ctx->failed = true;
+            return;
+        }
+    }
+    if(fseek(ctx->source, offset, SEEK_SET) != 0) {
+        ctx->failed = true;
+        return;
+    }
+    while(length > 0) {
+        uint32_t read_bytes = fread(copy_buffer, 1, min(length, WRITER_BUFFER_SIZE), ctx->source);
+        if(read_bytes == 0) break;
+        writer_data(ctx, copy_buffer, read_bytes);
+        if(ctx->failed) return;
+        length -= read_bytes;
+    }
+}
+
+static void writer_close(fsob_write_ctx_t *ctx, bool keep) {
+    bool complete = keep && (!ctx->resumable || ctx->final);
+
+    if(ctx->appfs) {
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+        if(!complete && ctx->resumable) {   //Keep the app for the next part
+            if(ctx->handle != APPFS_INVALID_FD) {
+                strcpy(appfs_resume.name, ctx->path);
+                appfs_resume.size = ctx->size;
+                appfs_resume.written = ctx->written;
+            }
+            return;
+        }
+        if(complete && !ctx->failed && ctx->written != ctx->size) {
+            ctx->failed = true;
+        }
+        if(complete && !ctx->failed && ctx->deploy) {
+            uint8_t hash[APPFS_HASH_SIZE];
+            if(!appfs_hash(ctx->handle, ctx->size, hash) || memcmp(hash, ctx->hash, APPFS_HASH_SIZE) != 0) {
+                ESP_LOGI(TAG, "Hash of %s does not match", ctx->path);
+                ctx->failed = true;
+            }
+        }
+        if(ctx->handle != APPFS_INVALID_FD && strcmp(appfs_resume.name, ctx->path) == 0) {
+            appfs_resume.name[0] = 0;   //Finished or deleted, nothing to resume anymore
+        }
+        if(ctx->handle != APPFS_INVALID_FD && (!complete || ctx->failed)) {
+            appfsDeleteFile(ctx->path);
+        }
+#endif
+        return;
+    }
+
+    if(ctx->source) {
+        fclose(ctx->source);
+        ctx->source = NULL;
+    }
+    if(ctx->fptr) {
+        if(fclose(ctx->fptr) != 0) ctx->failed = true;
+        ctx->fptr = NULL;
+    }
+    if(complete && !ctx->failed) {
+        remove(ctx->path);
+        if(rename(ctx->path_tmp, ctx->path) != 0) ctx->failed = true;
+        if(!ctx->failed && ctx->mtime) {
+            struct utimbuf times = {.actime = ctx->mtime, .modtime = ctx->mtime};
+            utime(ctx->path, &times);
+        }
+    } else if(!ctx->resumable) {
+        remove(ctx->path_tmp);
+    }
+}
+
+static void fsob_writer_task(void *pvParameters) {
+    writer_job_t job;
+    for(;;) {
+        if(xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+        int64_t start = esp_timer_get_time();
+        switch(job.op) {
+            case WRITER_OPEN:
+                writer_open(job.ctx);
+                job.ctx->flash_us += esp_timer_get_time() - start;
+                break;
+            case WRITER_DATA:
+                writer_data(job.ctx, job.buffer, job.length);
+                writer_release_buffer(job.buffer);
+                job.ctx->flash_us += esp_timer_get_time() - start;
+                break;
+            case WRITER_COMMIT:
+                writer_close(job.ctx, true);
+                fsob_stats_flash(job.message_id, job.ctx->flash_us + esp_timer_get_time() - start);
+                if(job.ctx->failed) {
+                    sender(job.command, job.message_id);
+                } else {
+                    sendok(job.command, job.message_id);
+                }
+                fsob_request_close(job.message_id);
+#if CONFIG_DRIVER_FSOVERBUS_APPFS_SUPPORT
+                if(job.ctx->deploy && !job.ctx->failed) {
+                    appfs_boot(job.ctx->handle);
+                }
+#endif
+                free(job.ctx);
+                break;
+            case WRITER_ABORT:
+                writer_close(job.ctx, false);
+                free(job.ctx);
+                break;
+            case WRITER_SYNC:
+                xSemaphoreGive(job.done);
+                break;
+            case WRITER_COPY:
+                writer_copy(job.ctx, job.offset, job.length);
+                job.ctx->flash_us += esp_timer_get_time() - start;
+                break;
+            case WRITER_CLOSE:
+                writer_close(job.ctx, true);
+                fsob_stats_flash(job.message_id, job.ctx->flash_us + esp_timer_get_time() - start);
+                if(group_id != job.message_id) {
+                    group_id = job.message_id;
+                    group_failed = false;
+                }
+                group_failed = group_failed || job.ctx->failed;
+                free(job.ctx);
+                break;
+            case WRITER_REPLY:
+                if(job.failed || (group_id == job.message_id && group_failed)) {
+                    sender(job.command, job.message_id);
+                } else {
+                    sendok(job.command, job.message_id);
+                }
+                group_failed = false;
+                fsob_request_close(job.message_id);
+                break;
+        }
+    }
+}
+
+/***
+ * Receiving task side.
+ ***/
+static fsob_write_ctx_t *writer_alloc_ctx(void) {
+    fsob_write_ctx_t *ctx = calloc(1, sizeof(fsob_write_ctx_t));
+    if(ctx == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate write context");
+        return NULL;
+    }
+    ctx->handle = APPFS_INVALID_FD;
+    return ctx;
+}
+
+static void writer_flush(fsob_write_ctx_t *ctx) {
+    if(ctx->buffer == NULL) return;
+    if(ctx->buffer_fill == 0) {
+        writer_release_buffer(ctx->buffer);
+    } else {
+        writer_send_job(WRITER_DATA, ctx, ctx->buffer, ctx->buffer_fill, 0, 0);
+    }
+    ctx->buffer = NULL;
+    ctx->buffer_fill = 0;
+}
+
+static fsob_write_ctx_t *writer_open_file(const char *path, bool resumable, uint32_t offset, bool final) {
+    fsob_write_ctx_t *ctx = writer_alloc_ctx();
+    if(ctx == NULL) return NULL;
+
+    ctx->resumable = resumable;
+    ctx->offset = offset;
+    ctx->final = final;
+
+    buildfile((char *) path, ctx->path);
+    int len = snprintf(ctx->path_tmp, sizeof(ctx->path_tmp), "%s.tmp", ctx->path);
+    if(len < 0 || len >= sizeof(ctx->path_tmp)) {
+        ESP_LOGE(TAG, "Buffer is too small");
+        free(ctx);
+        return NULL;
+    }
+    writer_send_job(WRITER_OPEN, ctx, NULL, 0, 0, 0);
+    return ctx;
+}
+
+static fsob_write_ctx_t *writer_open_appfs(const char *name, uint32_t size, bool resumable, uint32_t offset, bool final) {
+    if(strlen(name) >= sizeof(((fsob_write_ctx_t *) 0)->path)) return NULL;
+    fsob_write_ctx_t *ctx = writer_alloc_ctx();
+    if(ctx == NULL) return NULL;
+
+    ctx->appfs = true;
+    ctx->size = size;
+    ctx->resumable = resumable;
+    ctx->offset = offset;
+    ctx->final = final;
+    strcpy(ctx->path, name);
+    writer_send_job(WRITER_OPEN, ctx, NULL, 0, 0, 0);
+    return ctx;
+}
+
+fsob_write_ctx_t *fsob_writer_open_file(const char *path) {
+    return writer_open_file(path, false, 0, true);
+}
+
+fsob_write_ctx_t *fsob_writer_open_appfs(const char *name, uint32_t size) {
+    return writer_open_appfs(name, size, false, 0, true);
+}
+
+/*
+* Open one part of a file that is sent in several transfers. A part that is not final, or gets cut off, leaves the
+* temporary file (or the AppFS file) in place so the next part can continue at its end.
+*/
+fsob_write_ctx_t *fsob_writer_open_file_part(const char *path, uint32_t offset, bool final) {
+    return writer_open_file(path, true, offset, final);
+}
+
+fsob_write_ctx_t *fsob_writer_open_appfs_part(const char *name, uint32_t size, uint32_t offset, bool final) {
+    return writer_open_appfs(name, size, true, offset, final);
+}
+
+/*
+* Offset the next part of path has to start at, 0 when there is nothing to continue.
+*/
+uint32_t fsob_writer_resume_offset(const char *path, bool appfs) {
+    fsob_writer_sync();     //Parts still queued change the offset
+    if(appfs) {
+        return strcmp(appfs_resume.name, path) == 0 ? appfs_resume.written : 0;
+    }
+
+    char path_tmp[256];
+    buildfile((char *) path, path_tmp);
+    if(strlen(path_tmp) + 4 >= sizeof(path_tmp)) return 0;
+    strcat(path_tmp, ".tmp");
+    struct stat st;
+    if(stat(path_tmp, &st) != 0) return 0;
+    return st.st_size;
+}
+
+/*
+* Copy data into the pool. Blocks when all buffers are in use, which holds off the bus until the flash caught up.
+*/
+void fsob_writer_write(fsob_write_ctx_t *ctx, const uint8_t *data, uint32_t length) {
+    while(length > 0) {
+        if(ctx->buffer == NULL) {
+            xQueueReceive(free_queue, &ctx->buffer, portMAX_DELAY);
+            ctx->buffer_fill = 0;
+        }
+        uint32_t chunk = min(length, WRITER_BUFFER_SIZE - ctx->buffer_fill);
+        memcpy(&ctx->buffer[ctx->buffer_fill], data, chunk);
+        ctx->buffer_fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if(ctx->buffer_fill == WRITER_BUFFER_SIZE) {
+            writer_flush(ctx);
+        }
+    }
+}
+
+/*
+* Append a range of the file that is being replaced. Used to rebuild a file from blocks that did not change.
+*/
+void fsob_writer_copy(fsob_write_ctx_t *ctx, uint32_t offset, uint32_t length) {
+    writer_flush(ctx);
+    writer_job_t job = {
+        .op = WRITER_COPY,
+        .ctx = ctx,
+        .offset = offset,
+        .length = length,
+    };
+    xQueueSend(job_queue, &job, portMAX_DELAY);
+}
+
+/*
+* Finish the transfer. The context is owned by the writer task afterwards, which replies once the data is stored.
+*/
+void fsob_writer_commit(fsob_write_ctx_t *ctx, uint16_t command, uint32_t message_id) {
+    writer_flush(ctx);
+    writer_send_job(WRITER_COMMIT, ctx, NULL, 0, command, message_id);
+}
+
+/*
+* Store the file without replying, for requests that write several files. Failures are collected per message id
+* and reported by fsob_writer_reply.
+*/
+void fsob_writer_close(fsob_write_ctx_t *ctx, uint32_t message_id) {
+    writer_flush(ctx);
+    writer_send_job(WRITER_CLOSE, ctx, NULL, 0, 0, message_id);
+}
+
+/*
+* Reply once every file queued before is stored. The reply is an error when failed is set or one of the files
+* closed for message_id failed. Closes the request.
+*/
+void fsob_writer_reply(uint16_t command, uint32_t message_id, bool failed) {
+    writer_job_t job = {
+        .op = WRITER_REPLY,
+        .command = command,
+        .message_id = message_id,
+        .failed = failed,
+    };
+    xQueueSend(job_queue, &job, portMAX_DELAY);
+}
+
+//Modification time to give the file once it is stored
+void fsob_writer_set_mtime(fsob_write_ctx_t *ctx, uint32_t mtime) {
+    ctx->mtime = mtime;
+}
+
+//Check the AppFS file against hash once it is stored and boot it
+void fsob_writer_set_deploy(fsob_write_ctx_t *ctx, const uint8_t *hash) {
+    ctx->deploy = true;
+    memcpy(ctx->hash, hash, APPFS_HASH_SIZE);
+}
+
+void fsob_writer_abort(fsob_write_ctx_t *ctx) {
+    if(ctx->resumable) {
+        writer_flush(ctx);  //Data received so far is a valid start of the file, keep it for resuming
+    } else if(ctx->buffer) {
+        writer_release_buffer(ctx->buffer);
+        ctx->buffer = NULL;
+    }
+    writer_send_job(WRITER_ABORT, ctx, NULL, 0, 0, 0);
+}
+
+/*
+* Wait until all previously queued writes are completed.
+*/
+void fsob_writer_sync(void) {
+    writer_send_job(WRITER_SYNC, NULL, NULL, 0, 0, 0);
+    xSemaphoreTake(sync_done, portMAX_DELAY);
+}
+
+void fsob_writer_init(void) {
+    job_queue = xQueueCreate(WRITER_QUEUE_LEN, sizeof(writer_job_t));
+    free_queue = xQueueCreate(WRITER_BUFFERS, sizeof(uint8_t *));
+    sync_done = xSemaphoreCreateBinary();
+    if(job_queue == NULL || free_queue == NULL || sync_done == NULL) {
+        ESP_LOGE(TAG, "Failed to create writer queues");
+        return;
+    }
+
+    for(int i = 0; i < WRITER_BUFFERS; i++) {
+        uint8_t *buffer = malloc(WRITER_BUFFER_SIZE);
+        if(buffer == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate writer buffer %d", i);
+            break;
+        }
+        xQueueSend(free_queue, &buffer, 0);
+    }
+    copy_buffer = malloc(WRITER_BUFFER_SIZE);
+    xTaskCreatePinnedToCore(fsob_writer_task, "fsoverbus_writer", 8192, NULL, 10, NULL, 1);
+}
@@ -13,6 +13,7 @@
 #include "bootscreen.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "fpga_cache.h"
 #include "fpga_download.h"
 #include "fpga_util.h"
 #include "hardware.h"
@@ -125,14 +126,19 @@ static bool is_esp32_binary(FILE* fd) {
     return (magic_value == 0xE9);
 }
 
-static bool is_bitstream(FILE* fd) {
+static bool is_bitstream(FILE* fd, const char* filename) {
     const uint8_t expected_value[] = {0xFf, 0x00, 0x00, 0xff, 0x7e, 0xaa, 0x99, 0x7e};
+    const char*   compressed_ext   = ".bin.gz";
     if (get_file_size(fd) < sizeof(expected_value)) return false;
     fseek(fd, 0, SEEK_SET);
     uint8_t file_contents[sizeof(expected_value)];
     fread(file_contents, sizeof(expected_value), 1, fd);
     fseek(fd, 0, SEEK_SET);
-    return (memcmp(expected_value, file_contents, sizeof(expected_value)) == 0);
+    if (memcmp(expected_value, file_contents, sizeof(expected_value)) == 0) return true;
+    // Compressed bitstreams are only told apart from other gzip files by their name
+    size_t filename_len = strlen(filename);
+    return fpga_bitstream_is_compressed(file_contents, sizeof(file_contents)) && (filename_len > strlen(compressed_ext)) &&
+           (strcmp(&filename[filename_len - strlen(compressed_ext)], compressed_ext) == 0);
 }
 
 static void file_browser_open_file(xQueueHandle buttonQueue, pax_buf_t* pax_buffer, ILI9341* ili9341, const char* filename, const char* label) {
@@ -180,19 +186,16 @@ static void file_browser_open_file(xQueueHandle buttonQueue, pax_buf_t* pax_buff
         }
         free(path);
         return;
-    } else if (is_bitstream(fd)) {
+    } else if (is_bitstream(fd, filename)) {
         pax_draw_text(pax_buffer, 0xFF000000, font, 18, 0, 0, "FPGA bitstream\n\nPress A to run\nPress B to go back");
         ili9341_write(ili9341, pax_buffer->buf);
         if (wait_for_button(buttonQueue)) {
-            size_t   bitstream_length = get_file_size(fd);
-            uint8_t* bitstream        = load_file_to_ram(fd);
-            ICE40*   ice40            = get_ice40();
+            ICE40* ice40 = get_ice40();
             ili9341_deinit(ili9341);
             ili9341_select(ili9341, false);
             vTaskDelay(200 / portTICK_PERIOD_MS);
             ili9341_select(ili9341, true);
-            esp_err_t res = ice40_load_bitstream(ice40, bitstream, bitstream_length);
-            free(bitstream);
+            esp_err_t res = fpga_cache_load_file(ice40, filename, fd);
             fclose(fd);
             if (res == ESP_OK) {
                 fpga_irq_setup(ice40);
@@ -0,0 +1,293 @@
+/*
+ * fpga_cache.c
+ *
+ * Keeps the most recently loaded bitstreams in PSRAM, so switching
+ * between a few FPGA apps doesn't read them from FAT or SD every time.
+ * With bank switching enabled the himem region above the first 4 MB
+ * is used first, it is not part of the heap and otherwise unused.
+ */
+
+#include "fpga_cache.h"
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+#include <esp32/himem.h>
+#endif
+
+#include "fpga_util.h"
+#include "ice40.h"
+
+static const char* TAG = "fpga cache";
+
+typedef struct fpga_cache_entry {
+    struct fpga_cache_entry* next; /* Most recently used first */
+    char*                    path;
+    time_t                   mtime;
+    uint32_t                 size;
+    bool                     compressed; /* Stored as it was read, inflated again on every load */
+    uint32_t                 footprint; /* Memory taken, counted against the budget */
+    uint8_t*                 data;      /* Copy in PSRAM, NULL when stored in himem */
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+    esp_himem_handle_t himem;
+#endif
+} fpga_cache_entry_t;
+
+static fpga_cache_entry_t* g_entries = NULL;
+static uint32_t            g_used    = 0;
+
+/* ---------------------------------------------------------------------------
+ * Storage
+ * ------------------------------------------------------------------------ */
+
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+static esp_himem_rangehandle_t g_range       = NULL;
+static bool                    g_range_tried = false;
+
+static bool _himem_range(void) {
+    if (!g_range_tried) {
+        g_range_tried = true;
+        if (esp_himem_alloc_map_range(ESP_HIMEM_BLKSZ, &g_range) != ESP_OK) g_range = NULL;
+    }
+    return g_range != NULL;
+}
+
+/* Copy between a buffer and himem, one mapped block at a time */
+static bool _himem_copy(esp_himem_handle_t himem, uint32_t offset, uint8_t* buf, uint32_t len, bool write) {
+    while (len > 0) {
+        uint32_t block = offset - (offset % ESP_HIMEM_BLKSZ);
+        uint32_t start = offset - block;
+        uint32_t l     = (ESP_HIMEM_BLKSZ - start) < len ? (ESP_HIMEM_BLKSZ - start) : len;
+        uint8_t* ptr;
+        if (esp_himem_map(himem, g_range, block, 0, ESP_HIMEM_BLKSZ, 0, (void**) &ptr) != ESP_OK) return false;
+        if (write) {
+            memcpy(&ptr[start], buf, l);
+        } else {
+            memcpy(buf, &ptr[start], l);
+        }
+        esp_himem_unmap(g_range, ptr, ESP_HIMEM_BLKSZ);
+        offset += l;
+        buf += l;
+        len -= l;
+    }
+    return true;
+}
+#endif
+
+static void _entry_free(fpga_cache_entry_t* e) {
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+    if (e->himem) esp_himem_free(e->himem);
+#endif
+    free(e->data);
+    free(e->path);
+    g_used -= e->footprint;
+    free(e);
+}
+
+/* Drop least recently used entries until size more bytes fit in the budget */
+static void _evict(uint32_t size) {
+    while (g_entries && (g_used + size > FPGA_CACHE_BUDGET)) {
+        fpga_cache_entry_t** last = &g_entries;
+        while ((*last)->next) last = &(*last)->next;
+        ESP_LOGI(TAG, "Dropping %s", (*last)->path);
+        _entry_free(*last);
+        *last = NULL;
+    }
+}
+
+/* New entry with room for size bytes, not yet in the list */
+static fpga_cache_entry_t* _entry_alloc(const char* path, time_t mtime, uint32_t size) {
+    if (size == 0 || size > FPGA_CACHE_BUDGET) return NULL;
+
+    fpga_cache_entry_t* e = calloc(1, sizeof(fpga_cache_entry_t));
+    if (!e) return NULL;
+    e->path  = strdup(path);
+    e->mtime = mtime;
+    e->size  = size;
+    if (!e->path) goto error;
+
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+    uint32_t blocks = (size + ESP_HIMEM_BLKSZ - 1) / ESP_HIMEM_BLKSZ;
+    _evict(blocks * ESP_HIMEM_BLKSZ);
+    if (_himem_range() && (esp_himem_alloc(blocks * ESP_HIMEM_BLKSZ, &e->himem) == ESP_OK)) {
+        e->footprint = blocks * ESP_HIMEM_BLKSZ;
+        g_used += e->footprint;
+        return e;
+    }
+    e->himem = NULL;
+#endif
+
+    _evict(size);
+    e->data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!e->data) goto error;
+    e->footprint = size;
+    g_used += e->footprint;
+    return e;
+
+error:
+    free(e->path);
+    free(e);
+    return NULL;
+}
+
+static bool _entry_write(fpga_cache_entry_t* e, uint32_t offset, const uint8_t* buf, uint32_t len) {
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+    if (e->himem) return _himem_copy(e->himem, offset, (uint8_t*) buf, len, true);
+#endif
+    memcpy(&e->data[offset], buf, len);
+    return true;
+}
+
+
+static bool _entry_read(fpga_cache_entry_t* e, uint32_t offset, uint8_t* buf, uint32_t len) {
+#if CONFIG_SPIRAM_BANKSWITCH_ENABLE
+    if (e->himem) return _himem_copy(e->himem, offset, buf, len, false);
+#endif
+    memcpy(buf, &e->data[offset], len);
+    return true;
+}
+
+/* Remove any copy of path, cached ones with another mtime or size are stale */
+static void _drop(const char* path) {
+    fpga_cache_entry_t** p = &g_entries;
+    while (*p) {
+        if (strcmp((*p)->path, path) == 0) {
+            fpga_cache_entry_t* e = *p;
+            *p                    = e->next;
+            _entry_free(e);
+        } else {
+            p = &(*p)->next;
+        }
+    }
+}
+
+static void _insert(fpga_cache_entry_t* e) {
+    _drop(e->path);
+    e->next   = g_entries;
+    g_entries = e;
+}
+
+/* Find an entry and make it the most recently used one */
+static fpga_cache_entry_t* _lookup(const char* path, time_t mtime, uint32_t size) {
+    for (fpga_cache_entry_t** p = &g_entries; *p; p = &(*p)->next) {
+        fpga_cache_entry_t* e = *p;
+        if ((e->mtime == mtime) && (e->size == size) && (strcmp(e->path, path) == 0)) {
+            *p        = e->next;
+            e->next   = g_entries;
+            g_entries = e;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * Loading
+ * ------------------------------------------------------------------------ */
+
+typedef struct {
+    fpga_cache_entry_t* entry;
+    FILE*               fd; /* Source of a bitstream being cached, NULL when reading from the cache */
+    uint32_t            offset;
+    bool                ok;
+} fpga_cache_stream_t;
+
+static size_t _stream_read(void* ctx, uint8_t* buf, size_t len) {
+    fpga_cache_stream_t* stream = (fpga_cache_stream_t*) ctx;
+
+    // Never past the entry, the file may have grown since its size was taken
+    if (len > stream->entry->size - stream->offset) len = stream->entry->size - stream->offset;
+    if (len == 0) return 0;
+
+    if (stream->fd) {
+        len = fread(buf, 1, len, stream->fd);
+        // A copy that can't be completed is dropped afterwards, the bitstream still loads from the file
+        if (stream->ok) stream->ok = _entry_write(stream->entry, stream->offset, buf, len);
+    } else if (!_entry_read(stream->entry, stream->offset, buf, len)) {
+        return 0;
+    }
+
+    stream->offset += len;
+    return len;
+}
+
+bool fpga_cache_contains(const char* path, time_t mtime, uint32_t size) { return _lookup(path, mtime, size) != NULL; }
+
+static esp_err_t _stream_load(ICE40* ice40, fpga_cache_stream_t* stream, uint32_t size) {
+    if (stream->entry->compressed) return fpga_load_bitstream_compressed(ice40, _stream_read, stream, size);
+    return fpga_load_bitstream_stream(ice40, _stream_read, stream, size);
+}
+
+esp_err_t fpga_cache_load(ICE40* ice40, const char* path, time_t mtime, uint32_t size) {
+    fpga_cache_entry_t* e = _lookup(path, mtime, size);
+    if (!e) return ESP_ERR_NOT_FOUND;
+
+    ESP_LOGI(TAG, "Loading %s from cache", path);
+    fpga_cache_stream_t stream = {.entry = e, .fd = NULL, .offset = 0, .ok = true};
+    return _stream_load(ice40, &stream, size);
+}
+
+esp_err_t fpga_cache_load_file(ICE40* ice40, const char* path, FILE* fd) {
+    struct stat st;
+    uint8_t     magic[2];
+
+    if ((fstat(fileno(fd), &st) != 0) || (st.st_size <= 0)) return fpga_load_bitstream_file(ice40, fd);
+
+    esp_err_t res = fpga_cache_load(ice40, path, st.st_mtime, st.st_size);
+    if (res != ESP_ERR_NOT_FOUND) return res;
+
+    // Not cached, keep a copy while the bitstream streams into the FPGA
+    _drop(path);
+    fpga_cache_entry_t* e = _entry_alloc(path, st.st_mtime, st.st_size);
+    if (!e) return fpga_load_bitstream_file(ice40, fd);
+
+    fseek(fd, 0, SEEK_SET);
+    e->compressed = fpga_bitstream_is_compressed(magic, fread(magic, 1, sizeof(magic), fd));
+    fseek(fd, 0, SEEK_SET);
+    fpga_cache_stream_t stream = {.entry = e, .fd = fd, .offset = 0, .ok = true};
+    res                        = _stream_load(ice40, &stream, st.st_size);
+    // Inflating stops before the gzip trailer, the copy still needs it
+    uint8_t tail[16];
+    while ((res == ESP_OK) && stream.ok && (stream.offset < st.st_size)) {
+        size_t len = st.st_size - stream.offset;
+        if (_stream_read(&stream, tail, (len < sizeof(tail)) ? len : sizeof(tail)) == 0) break;
+    }
+    if ((res == ESP_OK) && stream.ok && (stream.offset == st.st_size)) {
+        _insert(e);
+    } else {
+        _entry_free(e);
+    }
+    return res;
+}
+
+void fpga_cache_put(const char* path, time_t mtime, const uint8_t* data, uint32_t size) {
+    if (_lookup(path, mtime, size)) return;
+
+    _drop(path);
+    fpga_cache_entry_t* e = _entry_alloc(path, mtime, size);
+    if (!e) return;
+
+    e->compressed = fpga_bitstream_is_compressed(data, size);
+    if (_entry_write(e, 0, data, size)) {
+        _insert(e);
+    } else {
+        _entry_free(e);
+    }
+}
+
+void fpga_cache_clear(void) {
+    while (g_entries) {
+        fpga_cache_entry_t* e = g_entries;
+        g_entries             = e->next;
+        _entry_free(e);
+    }
+}
@@ -11,6 +11,7 @@
 
 #include "driver/uart.h"
 #include "esp32/rom/crc.h"
+#include "fpga_cache.h"
 #include "fpga_util.h"
 #include "graphics_wrapper.h"
 #include "hardware.h"
@@ -144,6 +145,7 @@ static bool fpga_uart_download(ICE40* ice40, pax_buf_t* pax_buffer, ILI9341* ili
     TickType_t timeout = 1000 / portTICK_PERIOD_MS;
     uint8_t*   buffer  = NULL;
     bool       done    = false;
+    bool       cached  = false;
     struct {
         uint8_t  type;
         uint32_t fid;
@@ -214,6 +216,17 @@ static bool fpga_uart_download(ICE40* ice40, pax_buf_t* pax_buffer, ILI9341* ili
                     break;
                 }
 
+            case 'R':
+                {  // Bitstream from the cache, identified by its CRC with the length in place of the fid
+                    if (fpga_cache_contains(FPGA_CACHE_DOWNLOAD, header.crc, header.fid)) {
+                        done   = true;
+                        cached = true;
+                    } else {
+                        fpga_uart_mess("bitstream not cached\n");
+                    }
+                    break;
+                }
+
             default:
                 fpga_display_message(pax_buffer, ili9341, 0xa85a32, 0xFFFFFFFF, "Invalid packet type");
                 return false;
@@ -228,8 +241,14 @@ static bool fpga_uart_download(ICE40* ice40, pax_buf_t* pax_buffer, ILI9341* ili
     vTaskDelay(200 / portTICK_PERIOD_MS);
     ili9341_select(ili9341, true);
 
-    esp_err_t res = ice40_load_bitstream(ice40, buffer, header.len);
-    free(buffer);
+    esp_err_t res;
+    if (cached) {
+        res = fpga_cache_load(ice40, FPGA_CACHE_DOWNLOAD, header.crc, header.fid);
+    } else {
+        res = fpga_load_bitstream_buffer(ice40, buffer, header.len);
+        if (res == ESP_OK) fpga_cache_put(FPGA_CACHE_DOWNLOAD, header.crc, buffer, header.len);
+    }
+    free(buffer);  // An 'R' packet may carry a payload as well
     if (res != ESP_OK) {
         ice40_disable(ice40);
         ili9341_init(ili9341);
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "fpga_util.h"
 #include "hardware.h"
 #include "ice40.h"
 #include "ili9341.h"
@@ -15,8 +16,8 @@
 #include "rp2040.h"
 #include "test_common.h"
 
-extern const uint8_t fpga_selftest_bin_start[] asm("_binary_fpga_selftest_bin_start");
-extern const uint8_t fpga_selftest_bin_end[] asm("_binary_fpga_selftest_bin_end");
+extern const uint8_t fpga_selftest_bin_gz_start[] asm("_binary_fpga_selftest_bin_gz_start");
+extern const uint8_t fpga_selftest_bin_gz_end[] asm("_binary_fpga_selftest_bin_gz_end");
 
 static const char* TAG = "fpga_test";
 
@@ -115,7 +116,7 @@ static bool test_bitstream_load(uint32_t* rc) {
     ICE40*    ice40 = get_ice40();
     esp_err_t res;
 
-    res = ice40_load_bitstream(ice40, fpga_selftest_bin_start, fpga_selftest_bin_end - fpga_selftest_bin_start);
+    res = fpga_load_bitstream_buffer(ice40, fpga_selftest_bin_gz_start, fpga_selftest_bin_gz_end - fpga_selftest_bin_gz_start);
     if (res != ESP_OK) {
         *rc = res;
         return false;
@@ -14,14 +14,17 @@
 #include <driver/gpio.h>
 #include <errno.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "esp32/rom/miniz.h"
 #include "ice40.h"
 #include "rp2040.h"
 
@@ -584,3 +587,246 @@ error:
     if (err) *err = res;
     return false;
 }
+
+/* ---------------------------------------------------------------------------
+ * Bitstream loading
+ * ------------------------------------------------------------------------ */
+
+/* Largest single SPI DMA transfer */
+#define BITSTREAM_CHUNK 4092
+
+/* Compressed input read from the source at a time */
+#define BITSTREAM_GZ_INPUT 1024
+
+/* Configure the iCE40 from a source, with until_end the bitstream ends when the source runs dry instead of after length bytes */
+static esp_err_t _fpga_load_bitstream(ICE40 *ice40, fpga_bitstream_read_t read, void *ctx, size_t length, bool until_end) {
+    esp_err_t res;
+    uint8_t  *buf;
+    bool      done = false;
+
+    // Only one block is in RAM at a time, DMA capable so the SPI driver sends it without a bounce buffer.
+    // All transfers use the turbo device, it does not drive SS, which leaves framing the whole configuration to us.
+    buf = heap_caps_malloc(BITSTREAM_CHUNK, MALLOC_CAP_DMA);
+    if (!buf) return ESP_ERR_NO_MEM;
+
+    // Releasing reset with SS low selects SPI slave configuration
+    res = ice40_disable(ice40);
+    if (res != ESP_OK) goto done;
+    res = gpio_set_level(ice40->pin_cs, 0);
+    if (res != ESP_OK) goto done;
+    vTaskDelay(pdMS_TO_TICKS(1));
+    res = ice40_enable(ice40);
+    if (res != ESP_OK) goto done;
+
+    // Wait for the configuration memory to be cleared (at least 1200 us), then 8 clocks with SS high
+    vTaskDelay(pdMS_TO_TICKS(2));
+    res = gpio_set_level(ice40->pin_cs, 1);
+    if (res != ESP_OK) goto done;
+    buf[0] = 0x00;
+    res    = ice40_send_turbo(ice40, buf, 1);
+    if (res != ESP_OK) goto done;
+
+    // Bitstream, read from the source block by block while SS stays low for the whole stream
+    res = gpio_set_level(ice40->pin_cs, 0);
+    if (res != ESP_OK) goto done;
+    while (until_end || (length > 0)) {
+        size_t len = read(ctx, buf, (!until_end && (length < BITSTREAM_CHUNK)) ? length : BITSTREAM_CHUNK);
+        if (len == 0) {
+            if (!until_end) res = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        res = ice40_send_turbo(ice40, buf, len);
+        if (res != ESP_OK) break;
+        if (!until_end) length -= len;
+    }
+    gpio_set_level(ice40->pin_cs, 1);
+    if (res != ESP_OK) goto done;
+
+    // At least 49 more clocks with SS high to start the user design
+    memset(buf, 0x00, 13);
+    res = ice40_send_turbo(ice40, buf, 13);
+    if (res != ESP_OK) goto done;
+
+    res = ice40_get_done(ice40, &done);
+    if ((res == ESP_OK) && !done) res = ESP_FAIL;
+
+done:
+    free(buf);
+    return res;
+}
+
+esp_err_t fpga_load_bitstream_stream(ICE40 *ice40, fpga_bitstream_read_t read, void *ctx, size_t length) {
+    return _fpga_load_bitstream(ice40, read, ctx, length, false);
+}
+
+/* gzip decompression, inflating with the tinfl decoder in ROM */
+
+struct fpga_gz {
+    fpga_bitstream_read_t read;
+    void                 *ctx;
+    size_t                remaining;  // Compressed bytes not yet read from the source
+    uint8_t               in[BITSTREAM_GZ_INPUT];
+    size_t                in_ofs;
+    size_t                in_len;
+    tinfl_decompressor    inflator;
+    tinfl_status          status;
+    uint8_t               dict[TINFL_LZ_DICT_SIZE];  // Output, wraps around as the deflate window
+    size_t                dict_ofs;                  // Where the next inflated byte goes
+    size_t                out_ofs;                   // Inflated bytes not handed out yet
+    size_t                out_len;
+};
+
+static void _fpga_gz_fill(struct fpga_gz *gz) {
+    if ((gz->in_ofs < gz->in_len) || (gz->remaining == 0)) return;
+
+    size_t len = gz->read(gz->ctx, gz->in, gz->remaining < BITSTREAM_GZ_INPUT ? gz->remaining : BITSTREAM_GZ_INPUT);
+    gz->in_ofs = 0;
+    gz->in_len = len;
+    gz->remaining = (len == 0) ? 0 : gz->remaining - len;
+}
+
+static bool _fpga_gz_byte(struct fpga_gz *gz, uint8_t *value) {
+    _fpga_gz_fill(gz);
+    if (gz->in_ofs >= gz->in_len) return false;
+    *value = gz->in[gz->in_ofs++];
+    return true;
+}
+
+/* Skip the gzip member header (RFC 1952) up to the deflate data */
+static bool _fpga_gz_header(struct fpga_gz *gz) {
+    uint8_t hdr[10];
+    uint8_t value;
+
+    for (size_t i = 0; i < sizeof(hdr); i++)
+        if (!_fpga_gz_byte(gz, &hdr[i])) return false;
+
+    // Magic and deflate method
+    if ((hdr[0] != 0x1f) || (hdr[1] != 0x8b) || (hdr[2] != 0x08)) return false;
+
+    // FEXTRA
+    if (hdr[3] & 0x04) {
+        uint8_t lo, hi;
+        if (!_fpga_gz_byte(gz, &lo) || !_fpga_gz_byte(gz, &hi)) return false;
+        for (int i = lo | (hi << 8); i > 0; i--)
+            if (!_fpga_gz_byte(gz, &value)) return false;
+    }
+
+    // FNAME and FCOMMENT, zero terminated
+    for (uint8_t flag = 0x08; flag <= 0x10; flag <<= 1) {
+        if (!(hdr[3] & flag)) continue;
+        do {
+            if (!_fpga_gz_byte(gz, &value)) return false;
+        } while (value != 0);
+    }
+
+    // FHCRC
+    if (hdr[3] & 0x02) {
+        if (!_fpga_gz_byte(gz, &value) || !_fpga_gz_byte(gz, &value)) return false;
+    }
+
+    return true;
+}
+
+static size_t _fpga_gz_read(void *ctx, uint8_t *buf, size_t len) {
+    struct fpga_gz *gz   = (struct fpga_gz *) ctx;
+    size_t          done = 0;
+
+    while (done < len) {
+        // Hand out what was inflated before
+        if (gz->out_len > 0) {
+            size_t l = (len - done) < gz->out_len ? (len - done) : gz->out_len;
+            memcpy(&buf[done], &gz->dict[gz->out_ofs], l);
+            gz->out_ofs += l;
+            gz->out_len -= l;
+            done += l;
+            continue;
+        }
+
+        if (gz->status <= TINFL_STATUS_DONE) break;
+
+        // Inflate up to the end of the window, it is contiguous there
+        _fpga_gz_fill(gz);
+        size_t in_size  = gz->in_len - gz->in_ofs;
+        size_t out_size = TINFL_LZ_DICT_SIZE - gz->dict_ofs;
+        gz->status      = tinfl_decompress(&gz->inflator, &gz->in[gz->in_ofs], &in_size, gz->dict, &gz->dict[gz->dict_ofs], &out_size,
+                                           gz->remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+        gz->in_ofs += in_size;
+        gz->out_ofs  = gz->dict_ofs;
+        gz->out_len  = out_size;
+        gz->dict_ofs = (gz->dict_ofs + out_size) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+
+    return done;
+}
+
+bool fpga_bitstream_is_compressed(const uint8_t *data, size_t len) { return (len >= 2) && (data[0] == 0x1f) && (data[1] == 0x8b); }
+
+esp_err_t fpga_load_bitstream_compressed(ICE40 *ice40, fpga_bitstream_read_t read, void *ctx, size_t length) {
+    esp_err_t       res;
+    struct fpga_gz *gz;
+
+    // Too large for internal RAM, the window ends up in PSRAM
+    gz = malloc(sizeof(struct fpga_gz));
+    if (!gz) return ESP_ERR_NO_MEM;
+
+    gz->read      = read;
+    gz->ctx       = ctx;
+    gz->remaining = length;
+    gz->in_ofs    = 0;
+    gz->in_len    = 0;
+    gz->status    = TINFL_STATUS_NEEDS_MORE_INPUT;
+    gz->dict_ofs  = 0;
+    gz->out_ofs   = 0;
+    gz->out_len   = 0;
+    tinfl_init(&gz->inflator);
+
+    if (!_fpga_gz_header(gz)) {
+        free(gz);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The inflated size is only known at the end, so load until the decoder is done
+    res = _fpga_load_bitstream(ice40, _fpga_gz_read, gz, 0, true);
+    if ((res == ESP_OK) && (gz->status != TINFL_STATUS_DONE)) res = ESP_ERR_INVALID_SIZE;
+
+    free(gz);
+    return res;
+}
+
+/* Sources */
+
+struct fpga_buffer {
+    const uint8_t *data;
+    size_t         ofs;
+    size_t         len;
+};
+
+static size_t _fpga_buffer_read(void *ctx, uint8_t *buf, size_t len) {
+    struct fpga_buffer *b = (struct fpga_buffer *) ctx;
+    if (len > b->len - b->ofs) len = b->len - b->ofs;
+    memcpy(buf, &b->data[b->ofs], len);
+    b->ofs += len;
+    return len;
+}
+
+static size_t _fpga_bitstream_fread(void *ctx, uint8_t *buf, size_t len) { return fread(buf, 1, len, (FILE *) ctx); }
+
+esp_err_t fpga_load_bitstream_buffer(ICE40 *ice40, const uint8_t *data, size_t length) {
+    struct fpga_buffer b = {.data = data, .ofs = 0, .len = length};
+    if (fpga_bitstream_is_compressed(data, length)) return fpga_load_bitstream_compressed(ice40, _fpga_buffer_read, &b, length);
+    return fpga_load_bitstream_stream(ice40, _fpga_buffer_read, &b, length);
+}
+
+esp_err_t fpga_load_bitstream_file(ICE40 *ice40, FILE *fd) {
+    uint8_t magic[2];
+
+    fseek(fd, 0, SEEK_END);
+    long length = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    if (length <= 0) return ESP_ERR_INVALID_SIZE;
+
+    size_t magic_len = fread(magic, 1, sizeof(magic), fd);
+    fseek(fd, 0, SEEK_SET);
+    if (fpga_bitstream_is_compressed(magic, magic_len)) return fpga_load_bitstream_compressed(ice40, _fpga_bitstream_fread, fd, length);
+    return fpga_load_bitstream_stream(ice40, _fpga_bitstream_fread, fd, length);
+}
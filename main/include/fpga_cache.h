@@ -0,0 +1,32 @@
+/*
+ * fpga_cache.h
+ *
+ * Cache of recently loaded bitstreams in PSRAM
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ice40.h"
+
+/* Memory all cached bitstreams together may use, least recently used ones are dropped first */
+#define FPGA_CACHE_BUDGET (CONFIG_FPGA_CACHE_BUDGET_KB * 1024)
+
+/* Path used as key for bitstreams received by fpga_download, with the CRC in place of the mtime */
+#define FPGA_CACHE_DOWNLOAD "<download>"
+
+/* Load the bitstream stored at path, from the cache when path, mtime and size match */
+esp_err_t fpga_cache_load_file(ICE40* ice40, const char* path, FILE* fd);
+/* Whether a bitstream is cached, without loading it */
+bool      fpga_cache_contains(const char* path, time_t mtime, uint32_t size);
+/* Load a bitstream from the cache only, ESP_ERR_NOT_FOUND when it is not cached */
+esp_err_t fpga_cache_load(ICE40* ice40, const char* path, time_t mtime, uint32_t size);
+/* Store a copy of a bitstream that was loaded from elsewhere */
+void      fpga_cache_put(const char* path, time_t mtime, const uint8_t* data, uint32_t size);
+void      fpga_cache_clear(void);
@@ -11,6 +11,7 @@
 #include <freertos/queue.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "ice40.h"
 
@@ -65,3 +66,19 @@ int  fpga_req_add_file_data(uint32_t fid, void *data, size_t len);
 void fpga_req_del_file(uint32_t fid);
 
 bool fpga_req_process(const char *prefix, ICE40 *ice40, TickType_t wait, esp_err_t *err);
+
+/* Bitstream loading ------------------------------------------------------ */
+
+/* Fill buf with up to len bytes of the bitstream, returns the amount read (0 on error) */
+typedef size_t (*fpga_bitstream_read_t)(void *ctx, uint8_t *buf, size_t len);
+
+/* Compressed bitstreams are gzip files, recognized by their first two bytes */
+bool fpga_bitstream_is_compressed(const uint8_t *data, size_t len);
+
+esp_err_t fpga_load_bitstream_stream(ICE40 *ice40, fpga_bitstream_read_t read, void *ctx, size_t length);
+/* length is the compressed size, the bitstream is inflated while it is sent */
+esp_err_t fpga_load_bitstream_compressed(ICE40 *ice40, fpga_bitstream_read_t read, void *ctx, size_t length);
+/* Raw or compressed bitstream in memory */
+esp_err_t fpga_load_bitstream_buffer(ICE40 *ice40, const uint8_t *data, size_t length);
+/* Raw or compressed bitstream in a file */
+esp_err_t fpga_load_bitstream_file(ICE40 *ice40, FILE *fd);
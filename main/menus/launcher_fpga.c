@@ -16,6 +16,7 @@
 #include "appfs.h"
 #include "appfs_wrapper.h"
 #include "bootscreen.h"
+#include "fpga_cache.h"
 #include "fpga_download.h"
 #include "fpga_util.h"
 #include "graphics_wrapper.h"
@@ -38,6 +39,10 @@ static void start_fpga_app(xQueueHandle button_queue, pax_buf_t* pax_buffer, ILI
     char              filename[128];
     snprintf(filename, sizeof(filename), "%s/bitstream.bin", path);
     FILE* fd = fopen(filename, "rb");
+    if (fd == NULL) {
+        snprintf(filename, sizeof(filename), "%s/bitstream.bin.gz", path);
+        fd = fopen(filename, "rb");
+    }
     if (fd == NULL) {
         pax_background(pax_buffer, 0xFFFFFF);
         pax_draw_text(pax_buffer, 0xFFFF0000, font, 18, 0, 0, "Failed to open file\n\nPress A or B to go back");
@@ -45,15 +50,12 @@ static void start_fpga_app(xQueueHandle button_queue, pax_buf_t* pax_buffer, ILI
         wait_for_button(button_queue);
         return;
     }
-    size_t   bitstream_length = get_file_size(fd);
-    uint8_t* bitstream        = load_file_to_ram(fd);
-    ICE40*   ice40            = get_ice40();
+    ICE40* ice40 = get_ice40();
     ili9341_deinit(ili9341);
     ili9341_select(ili9341, false);
     vTaskDelay(200 / portTICK_PERIOD_MS);
     ili9341_select(ili9341, true);
-    esp_err_t res = ice40_load_bitstream(ice40, bitstream, bitstream_length);
-    free(bitstream);
+    esp_err_t res = fpga_cache_load_file(ice40, filename, fd);
     fclose(fd);
     if (res == ESP_OK) {
         fpga_irq_setup(ice40);